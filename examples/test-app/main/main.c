@@ -1,4 +1,3 @@
-
 #include <stdio.h>
 
 #include "freertos/FreeRTOS.h"
@@ -13,11 +12,82 @@ static void delay(uint32_t duration) {
     vTaskDelay((duration + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS);
 }
 
-void app_main(void) {
 
-    ffx_init(ffx_demo_backgroundPixies, NULL);
+///////////////////////////////
+// Covered push check
+//
+// A Panel covered by an async child still runs its timers, but must not
+// be able to push beneath the child (see ffx_pushPanelAsync).
+
+typedef struct CheckState {
+    int childId;
+    int coverTimer;
+    bool refused;
+} CheckState;
+
+static void onChildTimer(FfxEvent event, FfxEventProps props, void *arg) {
+    ffx_popPanel(0);
+}
+
+static int initChild(FfxScene scene, FfxNode node, void *state, void *arg) {
+    ffx_onEvent(FfxEventTimer, onChildTimer, NULL);
+
+    // Stay on top until the parent's covered timer has fired
+    if (ffx_setTimeout(1000) == 0) { ffx_popPanel(0); }
+
+    return 0;
+}
+
+static void onCheckTimer(FfxEvent event, FfxEventProps props, void *_state) {
+    CheckState *state = _state;
+
+    // Cover this Panel, then try pushing once covered
+    if (state->childId == 0) {
+        state->childId = ffx_pushPanelAsync(initChild, 0, NULL);
+        state->coverTimer = ffx_setTimeout(500);
+        if (state->childId == 0 || state->coverTimer == 0) {
+            ffx_popPanel(1);
+        }
+        return;
+    }
+
+    if (props.timer.id != state->coverTimer) { return; }
+
+    int asyncId = ffx_pushPanelAsync(initChild, 0, NULL);
+    int result = ffx_pushPanel(initChild, 0, NULL);
+    state->refused = (asyncId == 0 && result == FFX_PANEL_REFUSED);
+}
+
+static void onCheckFocus(FfxEvent event, FfxEventProps props, void *_state) {
+    CheckState *state = _state;
+    if (props.panel.childId == 0) { return; }
+    ffx_popPanel(state->refused ? 0: 1);
+}
+
+static int initCheck(FfxScene scene, FfxNode node, void *state, void *arg) {
+    ffx_onEvent(FfxEventTimer, onCheckTimer, state);
+    ffx_onEvent(FfxEventFocus, onCheckFocus, state);
+
+    if (ffx_setTimeout(500) == 0) { ffx_popPanel(1); }
+
+    return 0;
+}
+
+
+///////////////////////////////
+// App
+
+static int initApp(void *arg) {
+    int result = ffx_pushPanel(initCheck, sizeof(CheckState), NULL);
+    printf("[test-app] push from covered panel: %s\n",
+      (result == 0) ? "refused (ok)": "FAILED");
+
+    return ffx_demo_pushPanelTest(NULL);
+}
+
+void app_main(void) {
 
-    ffx_demo_pushPanelTest(NULL);
+    ffx_init(FFX_VERSION(0, 0, 1), ffx_demo_backgroundPixies, initApp, NULL);
 
     while (1) {
         delay(10000);
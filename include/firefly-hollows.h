@@ -12,6 +12,8 @@ extern "C" {
 
 #include "firefly-cbor.h"
 #include "firefly-ecc.h"
+#include "firefly-eth.h"
+#include "firefly-hash.h"
 #include "firefly-scene.h"
 
 
@@ -78,10 +80,11 @@ typedef enum FfxKey {
 
 
 typedef enum FfxEvent{
-    // Fired on each render (supressed if unhandled render present)
+    // Fired on each render (coalesced with an unhandled render present,
+    // accumulating the dt)
     FfxEventRenderScene,
 
-    // Fired on radio state changes
+    // Fired on radio state changes (only the latest pending is kept)
     FfxEventRadioState,
 
     // Firefy on keypad events
@@ -93,6 +96,12 @@ typedef enum FfxEvent{
     // Fired when a message is received
     FfxEventMessage,
 
+    // Fired on the requesting panel on job progress and completion
+    FfxEventJob,
+
+    // Fired on the owning panel when a timeout or interval expires
+    FfxEventTimer,
+
     // User-defined event; only fired manually by emit
     FfxEventUser1,
     FfxEventUser2,
@@ -116,6 +125,10 @@ typedef struct FfxEventKeysProps {
 typedef struct FfxEventPanelProps {
     int id;
     bool firstFocus;
+
+    // When an async child (see ffx_pushPanelAsync) pops; its id and the
+    // status it passed to ffx_popPanel
+    int childId;
     int childresult;
 } FfxEventPanelProps;
 
@@ -131,12 +144,33 @@ typedef struct FfxEventRadioProps {
     bool connected;
 } FfxEventRadioProps;
 
+typedef enum FfxJobStatus {
+    FfxJobStatusProgress = 0,
+    FfxJobStatusDone,
+    FfxJobStatusFailed,
+    FfxJobStatusCancelled
+} FfxJobStatus;
+
+typedef struct FfxEventJobProps {
+    int id;
+    FfxJobStatus status;
+
+    // Only for FfxJobStatusProgress; the value is defined by the job
+    int progress;
+} FfxEventJobProps;
+
+typedef struct FfxEventTimerProps {
+    int id;
+} FfxEventTimerProps;
+
 typedef union FfxEventProps {
     FfxEventRenderSceneProps render;
     FfxEventKeysProps keys;
     FfxEventPanelProps panel;
     FfxEventMessageProps message;
     FfxEventRadioProps radio;
+    FfxEventJobProps job;
+    FfxEventTimerProps timer;
 } FfxEventProps;
 
 typedef void (*FfxEventFunc)(FfxEvent event, FfxEventProps props, void* arg);
@@ -155,16 +189,155 @@ bool ffx_hasEvent(FfxEvent event);
 
 /**
  *  Calls the handler for %%event%% on the Active Panel with %%props%%,
- *  returning true if there was a handler installed.
+ *  returning true if there was a handler installed and the event was
+ *  queued (false if the Panel's event queue is full).
+ *
+ *  Keys, focus, messages and job completion are never dropped once
+ *  queued and are dispatched ahead of other events; room is reserved
+ *  for them, so other events backing up during a long handler cannot
+ *  crowd them out. Renders, radio state and job progress are coalesced
+ *  with any pending event of the same kind (renders before queuing, so
+ *  they never take room).
  */
 bool ffx_emitEvent(FfxEvent event, FfxEventProps props);
 
 /**
  *  Remove the handler for %%event%% on the Active Panel, returning true if
- *  there was a handler installed.
+ *  there was a handler installed. This also unsubscribes the event.
  */
 bool ffx_offEvent(FfxEvent event);
 
+/**
+ *  Also deliver %%event%% to the calling Panel while it is covered by a
+ *  child Panel, using the handler installed with [[ffx_onEvent]], so it
+ *  can keep cached state current and refocus instantly.
+ *
+ *  Only [[FfxEventRadioState]] and the user events may be subscribed.
+ *  Covered Panels which are not subscribed are never woken for an event.
+ *  Subscribed events are coalesced as usual and dispatched once the
+ *  Panel is active again.
+ *
+ *  Returns false if the event cannot be subscribed or has no handler.
+ */
+bool ffx_subscribeEvent(FfxEvent event);
+
+/**
+ *  Stop delivering %%event%% to the calling Panel while it is covered,
+ *  returning true if it was subscribed.
+ */
+bool ffx_unsubscribeEvent(FfxEvent event);
+
+
+///////////////////////////////
+// Jobs
+
+/**
+ *  The function signature used by [[ffx_runJob]]. This is called on the
+ *  job worker task with the job %%id%% and the %%arg%% passed to
+ *  [[ffx_runJob]], returning true on success.
+ */
+typedef bool (*FfxJobFunc)(int id, void *arg);
+
+/**
+ *  Run %%func%% on the job worker task, so the calling Panel can keep
+ *  handling events (e.g. animating or accepting cancel) during heavy
+ *  work, such as signing.
+ *
+ *  Jobs are run one at a time, in the order added. On completion, the
+ *  calling Panel receives an [[FfxEventJob]] with the returned id and a
+ *  status of done, failed or cancelled. The %%arg%% must remain valid
+ *  until then, or until the Panel is popped (which cancels the job).
+ *
+ *  Returns 0 if the job could not be queued.
+ */
+int ffx_runJob(FfxJobFunc func, void *arg);
+
+/**
+ *  Cancel the job %%id%%, returning false if it has already completed.
+ *
+ *  A running job may check [[ffx_isJobCancelled]] to stop early. A job
+ *  cancelled before it started is still called (with
+ *  [[ffx_isJobCancelled]] already true), so it can release resources.
+ */
+bool ffx_cancelJob(int id);
+
+/**
+ *  Returns true if the job %%id%% has been cancelled, its Panel has been
+ *  popped or it has completed. A job must not write to the Panel state
+ *  once this is true.
+ */
+bool ffx_isJobCancelled(int id);
+
+/**
+ *  Report %%progress%% for the job %%id%%; the calling Panel receives an
+ *  [[FfxEventJob]] with the progress status if the value changed.
+ */
+void ffx_setJobProgress(int id, int progress);
+
+/**
+ *  The function signature used by [[ffx_speculateJob]] to discard the
+ *  results of a speculative job which was never claimed.
+ */
+typedef void (*FfxJobDiscardFunc)(int id, void *arg);
+
+/**
+ *  Run %%func%% speculatively on the job worker task for the message
+ *  %%messageId%%, so work such as hashing and key derivation can begin
+ *  while the user is still reviewing the request.
+ *
+ *  The results are private to the request; no [[FfxEventJob]] is sent
+ *  on completion. Instead, once the user approves, [[ffx_claimJob]]
+ *  waits for the job and takes ownership of its results.
+ *
+ *  If the job is cancelled, the message is replied to or the connection
+ *  is lost before the results are claimed, %%discardFunc%% is called on
+ *  the worker task (after %%func%% if it is still running), and must
+ *  wipe any secrets held in %%arg%%. It is only called if %%func%%
+ *  returned true.
+ *
+ *  Returns 0 if the job could not be queued.
+ */
+int ffx_speculateJob(int messageId, FfxJobFunc func,
+  FfxJobDiscardFunc discardFunc, void *arg);
+
+/**
+ *  Wait for the speculative job %%id%% to complete and claim its
+ *  results, returning true if it succeeded. Once claimed, the results
+ *  belong to the caller and are never discarded.
+ *
+ *  Returns false if the job failed or was discarded, in which case the
+ *  caller must perform the work itself.
+ */
+bool ffx_claimJob(int id);
+
+
+///////////////////////////////
+// Timers
+
+/**
+ *  Schedule an [[FfxEventTimer]] for the calling Panel after %%delay%%
+ *  ms, returning the timer id (or 0 if too many timers are scheduled).
+ *
+ *  Timers are checked once per frame, so may fire up to a frame late.
+ *  All timers for a Panel are cleared when it is popped.
+ */
+int ffx_setTimeout(uint32_t delay);
+
+/**
+ *  Schedule an [[FfxEventTimer]] for the calling Panel every %%period%%
+ *  ms until cleared, returning the timer id (or 0 on failure).
+ *
+ *  If the Panel falls behind, missed periods are skipped and pending
+ *  events for the timer are coalesced, rather than delivered as a burst.
+ */
+int ffx_setInterval(uint32_t period);
+
+/**
+ *  Cancel the timer %%id%%, returning false if it had already fired (for
+ *  a timeout), been cleared or was set by another Panel.
+ */
+bool ffx_clearTimer(int id);
+
 
 ///////////////////////////////
 // Radio + Messages
@@ -186,24 +359,62 @@ bool ffx_sendErrorReply(int id, uint32_t code, const char* mesage);
  *  The function signature used by [[ffx_pushPanel]] to configure a Panel.
  *
  *  The %%scene%% and %%node%% can be used with the firefly-scene API
- *  to configure the Panel view. The %%state%% is allocated on the task
- *  stack. The %%initArg%% is the value passed into [[ffx_pushPanel]].
+ *  to configure the Panel view. The %%state%% is zeroed and allocated
+ *  on the heap for the lifetime of the Panel. The %%initArg%% is the
+ *  value passed into [[ffx_pushPanel]].
  */
 typedef int (*FfxPanelInitFunc)(FfxScene scene, FfxNode node, void* state,
   void* initArg);
 
+// Returned by [[ffx_pushPanel]] if the Panel could not be pushed
+#define FFX_PANEL_REFUSED       (-1)
+
 /**
  *  Pushes a new Panel onto the Panel Stack, configured with %%initFunc%%.
  *
- *  The %%stateSize%% is used to allocate additional stack space for the
- *  Panel, passed as the state to the [[FfxPanelInitFunc]].
+ *  The %%stateSize%% is used to allocate the Panel state, passed as the
+ *  state to the [[FfxPanelInitFunc]].
+ *
+ *  All Panels share the app task. The new Panel's event loop runs
+ *  nested within this call, so it blocks until the Panel is popped and
+ *  returns the status passed to [[ffx_popPanel]]. Events for the calling
+ *  Panel are queued meanwhile.
+ *
+ *  Only the Active Panel may push; a Panel running beneath an async
+ *  child (see [[ffx_pushPanelAsync]]) is refused and this returns
+ *  [[FFX_PANEL_REFUSED]]. A push is also refused if the Panels are
+ *  nested too deeply for the app task stack or the Panel state cannot
+ *  be allocated.
  */
 int ffx_pushPanel(FfxPanelInitFunc initFunc, size_t stateSize, void *initArg);
 
+/**
+ *  Pushes a new Panel onto the Panel Stack, like [[ffx_pushPanel]], but
+ *  returns the child Panel id immediately.
+ *
+ *  The calling Panel is not blocked; it keeps receiving its timer and
+ *  job events, and any subscribed events (see [[ffx_subscribeEvent]]),
+ *  while the child is active. Keys and messages only go to the Active
+ *  Panel (the child). When the child pops, the caller receives an
+ *  [[FfxEventFocus]] with the %%childId%% and %%childresult%%.
+ *
+ *  A Panel cannot push or pop while it has an async child on the stack.
+ *  Returns 0 if not called from the Active Panel or the push is refused
+ *  (see [[ffx_pushPanel]]).
+ */
+int ffx_pushPanelAsync(FfxPanelInitFunc initFunc, size_t stateSize,
+  void *initArg);
+
 /**
  *  Pops the Active Panel from the Panel Stack, returning control
  *  to the previous Panel. The %%status%% is used as the return value to
  *  the corresponding [[ffx_pushPanel]].
+ *
+ *  This returns; the Panel's event loop exits once the current event
+ *  handler returns, and its state remains valid until then. Previously
+ *  this never returned, so any code following it in a handler (which
+ *  used to be unreachable) now runs; handlers should return right
+ *  after popping.
  */
 void ffx_popPanel(int status);
 
@@ -285,6 +496,42 @@ int ffx_pushInfo(FfxInfoInitFunc initFunc, const char* title,
 //  int duration, int repeat);
 
 
+///////////////////////////////
+// Warm-up
+
+/**
+ *  The function signature used by [[ffx_addWarmup]].
+ */
+typedef void (*FfxWarmupFunc)(void *arg);
+
+/**
+ *  Add a warm-up job, which calls %%func%% with %%arg%% on the prime
+ *  task when the CPU would otherwise be idle. This is useful to move
+ *  the first-use latency of an expensive feature (e.g. precomputing a
+ *  key or a QR code, decoding assets or filling a cache) out of the UI.
+ *
+ *  Jobs are run one at a time, in the order added, and their duration
+ *  is reported in [[ffx_dumpStats]]. The %%name%% must remain valid.
+ *
+ *  Returns the job id, or 0 if too many jobs are pending.
+ */
+int ffx_addWarmup(const char *name, FfxWarmupFunc func, void *arg);
+
+/**
+ *  Cancel the warm-up job %%id%%. A pending job is not run; a running
+ *  job may check [[ffx_isWarmupCancelled]] to stop early.
+ *
+ *  Returns false if the job has already finished.
+ */
+bool ffx_cancelWarmup(int id);
+
+/**
+ *  Returns true if called from a running warm-up job which has been
+ *  cancelled.
+ */
+bool ffx_isWarmupCancelled();
+
+
 ///////////////////////////////
 // Device Info
 
@@ -302,7 +549,8 @@ typedef enum FfxDeviceStatus {
 #define CHALLENGE_LENGTH    (32)
 
 typedef struct FfxDeviceAttestation {
-    // Version; should always be 1 (currently)
+    // Version; 1 for a single payload, 2 for a batch (in which case the
+    // challenge is the Merkle root of the payload hashes)
     uint8_t version;
 
     // A random nonce selected by the device during signing
@@ -329,12 +577,14 @@ typedef struct FfxDeviceAttestation {
 
 
 /**
- *  Returns the device serial number.
+ *  Returns the device serial number, or 0 until the provisioning data
+ *  has been loaded successfully (see [[ffx_deviceStatus]]).
  */
 int ffx_deviceSerialNumber();
 
 /**
- *  Returns the device model number.
+ *  Returns the device model number, or 0 until the provisioning data
+ *  has been loaded successfully (see [[ffx_deviceStatus]]).
  */
 int ffx_deviceModelNumber();
 
@@ -343,6 +593,9 @@ int ffx_deviceModelNumber();
  *  characters. This adds a NULL-termination as long as length is not 0.
  *
  *  e.g. "Firefly Pixie (rev.6)"
+ *
+ *  Until the provisioning data has been loaded successfully this is
+ *  ``"[unprovisioned]"`` and returns false.
  */
 bool ffx_deviceModelName(char *nameOut, size_t length);
 
@@ -351,6 +604,9 @@ bool ffx_deviceModelName(char *nameOut, size_t length);
  *  provisioned, the provisioned NVS partition is corrupt or the device
  *  has not been initialized this will return an error.
  *
+ *  This loads the provisioning data if it has not been loaded yet,
+ *  blocking until it has.
+ *
  *  This should basically never return an error.
  */
 FfxDeviceStatus ffx_deviceStatus();
@@ -360,12 +616,146 @@ FfxDeviceStatus ffx_deviceStatus();
  */
 bool ffx_hashAttest(uint8_t *digestOut, const FfxCborCursor *payload);
 
+// The maximum number of params an [[FfxAttestHasher]] supports
+#define FFX_ATTEST_MAX_PARAMS       (256)
+
+// The longest action signature (in bytes) an [[FfxAttestHasher]] buffers;
+// longer signatures are streamed into Keccak256 and are not cached
+#define FFX_ATTEST_MAX_SIGNATURE    (128)
+
+/**
+ *  An incremental attestation hasher, which computes the same digest
+ *  as [[ffx_hashAttest]] without needing the entire payload in memory.
+ *
+ *  The payload is fed in two phases:
+ *    - [[ffx_attestInit]], then [[ffx_attestAppendParam]] for the type
+ *      and name of each param, in order
+ *    - [[ffx_attestBeginValues]] with the salt, then for each param (in
+ *      the same order), its value using any number of calls to
+ *      [[ffx_attestUpdateValue]] followed by [[ffx_attestEndValue]]
+ *
+ *  then [[ffx_attestFinal]] to compute the digest. The value of a
+ *  ``bytes`` or ``string`` param may be any length and is streamed into
+ *  Keccak256; any other value must be at most 32 bytes.
+ *
+ *  If any call fails, all further calls fail.
+ */
+typedef struct FfxAttestHasher {
+    int phase;
+
+    // The domain (left-padded words)
+    uint8_t chainId[32];
+    uint8_t contract[32];
+
+    // The action signature string (while it fits), which keys the
+    // prefix cache; its length exceeds the buffer once streaming
+    uint8_t signature[FFX_ATTEST_MAX_SIGNATURE];
+    size_t signatureLength;
+
+    // The action signature string (once streaming), then the current
+    // dynamic value
+    FfxKeccak256Context ctx;
+
+    // The params that are dynamic (bytes or string)
+    uint8_t dynamic[FFX_ATTEST_MAX_PARAMS / 8];
+    size_t paramCount;
+
+    // The value chain: [ digest (32 bytes) ][ current value (32 bytes) ]
+    uint8_t scratch[64];
+    size_t valueCount;
+    size_t valueLength;
+} FfxAttestHasher;
+
+/**
+ *  Begin an attestation hash for the %%chainId%% and %%contract%% (each
+ *  at most 32 bytes) and %%action%%.
+ */
+bool ffx_attestInit(FfxAttestHasher *hasher, const uint8_t *chainId,
+  size_t chainIdLength, const uint8_t *contract, size_t contractLength,
+  const uint8_t *action, size_t actionLength);
+
+/**
+ *  Add the next param %%type%% and %%name%% to the action signature.
+ */
+bool ffx_attestAppendParam(FfxAttestHasher *hasher, const uint8_t *type,
+  size_t typeLength, const uint8_t *name, size_t nameLength);
+
+/**
+ *  End the params and begin the values with the 32-byte %%salt%%.
+ */
+bool ffx_attestBeginValues(FfxAttestHasher *hasher, const uint8_t *salt);
+
+/**
+ *  Add %%length%% bytes of %%data%% to the value of the current param.
+ */
+bool ffx_attestUpdateValue(FfxAttestHasher *hasher, const uint8_t *data,
+  size_t length);
+
+/**
+ *  End the value of the current param.
+ */
+bool ffx_attestEndValue(FfxAttestHasher *hasher);
+
+/**
+ *  Compute the attestation hash into %%digestOut%%. Every param must
+ *  have had its value ended.
+ */
+bool ffx_attestFinal(FfxAttestHasher *hasher, uint8_t *digestOut);
+
 /**
  *  Sign the attestation hash of %%payload%% with the device RSA privkey.
  */
 bool ffx_deviceAttest(FfxDeviceAttestation *attestOut,
   const FfxCborCursor *payload);
 
+/**
+ *  Begin signing the attestation hash of %%payload%% with the device RSA
+ *  privkey as a job (see [[ffx_runJob]]), without blocking the calling
+ *  Panel while the DS peripheral computes the signature.
+ *
+ *  The payload is hashed before this returns, but %%attestOut%% must
+ *  remain valid until the calling Panel receives the [[FfxEventJob]]
+ *  with the returned id. Returns 0 if the request could not be started.
+ */
+int ffx_deviceAttestAsync(FfxDeviceAttestation *attestOut,
+  const FfxCborCursor *payload);
+
+// The maximum number of payloads in [[ffx_deviceAttestBatch]]
+#define FFX_ATTEST_BATCH_MAX        (256)
+
+// The maximum number of sibling hashes in an [[FfxAttestProof]]
+#define FFX_ATTEST_PROOF_DEPTH      (8)
+
+typedef struct FfxAttestProof {
+    // The index of the payload in the batch, and the batch size
+    uint16_t index;
+    uint16_t count;
+
+    // The number of sibling hashes in path
+    uint8_t depth;
+
+    // The sibling hashes, from the leaf towards the root
+    uint8_t path[FFX_ATTEST_PROOF_DEPTH][32];
+} FfxAttestProof;
+
+/**
+ *  Sign the attestation hashes of %%count%% %%payloads%% with a single
+ *  device RSA signature over their Merkle root.
+ *
+ *  The %%attestOut%% has a version of 2 and the root as its challenge,
+ *  and each %%proofsOut%% entry is populated with the inclusion proof
+ *  for the payload at the same index.
+ */
+bool ffx_deviceAttestBatch(FfxDeviceAttestation *attestOut,
+  FfxAttestProof *proofsOut, const FfxCborCursor *payloads, size_t count);
+
+/**
+ *  Returns true if %%digest%% (as computed by [[ffx_hashAttest]]) is
+ *  included in the Merkle %%root%% using %%proof%%.
+ */
+bool ffx_verifyAttestProof(const uint8_t *root, const uint8_t *digest,
+  const FfxAttestProof *proof);
+
 /**
  *  Populates %%privkeyOut%% with the %%account%% private key. This uses
  *  the device DEV mnemonic with the "m/44'/60'/${ account }'/0/0" path.
@@ -375,6 +765,44 @@ bool ffx_deviceAttest(FfxDeviceAttestation *attestOut,
  */
 bool ffx_deviceTestPrivkey(FfxEcPrivkey *privkeyOut, uint32_t account);
 
+/**
+ *  Populates %%pubkeyOut%% with the %%account%% public key (see
+ *  [[ffx_deviceTestPrivkey]]).
+ *
+ *  Public data is cached in NVS (keyed to the device key material), so
+ *  once an account has been derived this does not need to derive its
+ *  private key again, even after a reboot.
+ */
+bool ffx_deviceTestPubkey(FfxEcPubkey *pubkeyOut, uint32_t account);
+
+/**
+ *  Populates %%addressOut%% with the %%account%% address, using the same
+ *  cache as [[ffx_deviceTestPubkey]].
+ */
+bool ffx_deviceTestAddress(FfxAddress *addressOut, uint32_t account);
+
+/**
+ *  Wipe all cached test key material from RAM. The next call to
+ *  [[ffx_deviceTestPrivkey]] must derive the keys from the start again.
+ *
+ *  This also happens automatically on restart.
+ */
+void ffx_deviceLock();
+
+/**
+ *  Log the time [[ffx_hashAttest]] takes for payloads with 1, 2, 4, ...
+ *  up to %%maxParams%% params.
+ */
+void ffx_deviceBenchmarkHashAttest(size_t maxParams);
+
+/**
+ *  Log the time [[ffx_deviceTestPrivkey]] takes for the first %%count%%
+ *  accounts, both without and with the cached m/44'/60' node.
+ *
+ *  Note: This wipes the test key cache (see [[ffx_deviceLock]]).
+ */
+void ffx_deviceBenchmarkTestPrivkey(uint32_t count);
+
 
 
 ///////////////////////////////
@@ -0,0 +1,353 @@
+#include <string.h>
+
+#include "nvs_flash.h"
+
+#include "host/ble_hs.h"
+#include "host/ble_store.h"
+
+#include "firefly-hollows.h"
+
+#include "ble-bonds.h"
+#include "utils.h"
+
+
+// The NVS namespace (in the default partition) which holds the bonds;
+// kept apart from the NimBLE namespace so it can be managed (and wiped)
+// on its own
+#define NVS_NAMESPACE         ("ffx-bonds")
+#define NVS_KEY               ("bonds")
+
+// Bump this if the layout of BondStore changes; a mismatched blob is
+// discarded (and the peers must pair again)
+#define BONDS_VERSION         (1)
+
+// Each peer subscribes to (at most) the FSP content, logger and battery
+#define MAX_CCCDS             (MAX_BONDS * 3)
+
+
+// The persisted state; entries are kept in least-recently used order, so
+// index 0 is the first to be evicted by ble_store_util_status_rr
+typedef struct BondStore {
+    uint32_t version;
+
+    size_t ourSecCount;
+    struct ble_store_value_sec ourSecs[MAX_BONDS];
+
+    size_t peerSecCount;
+    struct ble_store_value_sec peerSecs[MAX_BONDS];
+
+    size_t cccdCount;
+    struct ble_store_value_cccd cccds[MAX_CCCDS];
+} BondStore;
+
+static BondStore store = { 0 };
+
+static uint32_t pairingCount = 0;
+
+
+///////////////////////////////
+// Persistence
+
+static void save() {
+    nvs_handle_t nvs;
+    int ret = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret) {
+        FFX_LOG("failed to open bonds: ret=%d", ret);
+        return;
+    }
+
+    ret = nvs_set_blob(nvs, NVS_KEY, &store, sizeof(store));
+    if (ret == 0) { ret = nvs_commit(nvs); }
+    if (ret) { FFX_LOG("failed to save bonds: ret=%d", ret); }
+
+    nvs_close(nvs);
+}
+
+static void load() {
+    memset(&store, 0, sizeof(store));
+    store.version = BONDS_VERSION;
+
+    nvs_handle_t nvs;
+    int ret = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs);
+
+    // Nothing stored yet
+    if (ret) { return; }
+
+    size_t olen = sizeof(store);
+    ret = nvs_get_blob(nvs, NVS_KEY, &store, &olen);
+    nvs_close(nvs);
+
+    if (ret || olen != sizeof(store) || store.version != BONDS_VERSION ||
+      store.ourSecCount > MAX_BONDS || store.peerSecCount > MAX_BONDS ||
+      store.cccdCount > MAX_CCCDS) {
+
+        if (ret != ESP_ERR_NVS_NOT_FOUND) {
+            FFX_LOG("discarding bonds: ret=%d length=%d", ret, olen);
+        }
+
+        memset(&store, 0, sizeof(store));
+        store.version = BONDS_VERSION;
+    }
+}
+
+
+///////////////////////////////
+// Security entries
+
+static int findSec(const struct ble_store_key_sec *key,
+  const struct ble_store_value_sec *values, size_t count) {
+
+    int skipped = 0;
+
+    for (int i = 0; i < count; i++) {
+        const struct ble_store_value_sec *value = &values[i];
+
+        if (ble_addr_cmp(&key->peer_addr, BLE_ADDR_ANY)) {
+            if (ble_addr_cmp(&value->peer_addr, &key->peer_addr)) {
+                continue;
+            }
+        }
+
+        if (key->ediv_rand_present) {
+            if (value->ediv != key->ediv) { continue; }
+            if (value->rand_num != key->rand_num) { continue; }
+        }
+
+        if (key->idx > skipped) {
+            skipped++;
+            continue;
+        }
+
+        return i;
+    }
+
+    return -1;
+}
+
+// Move the entry at %%index%% to the end (most-recently used), returning
+// true if the order changed
+static bool touchSec(struct ble_store_value_sec *values, size_t count,
+  int index) {
+
+    if (index < 0 || index + 1 >= count) { return false; }
+
+    struct ble_store_value_sec value = values[index];
+    memmove(&values[index], &values[index + 1],
+      (count - index - 1) * sizeof(value));
+    values[count - 1] = value;
+
+    return true;
+}
+
+static int writeSec(const struct ble_store_value_sec *value,
+  struct ble_store_value_sec *values, size_t *count) {
+
+    struct ble_store_key_sec key = { 0 };
+    ble_store_key_from_value_sec(&key, value);
+
+    int index = findSec(&key, values, *count);
+    if (index == -1) {
+        if (*count >= MAX_BONDS) { return BLE_HS_ESTORE_CAP; }
+        index = (*count)++;
+    }
+
+    values[index] = *value;
+    touchSec(values, *count, index);
+
+    return 0;
+}
+
+static int deleteSec(const struct ble_store_key_sec *key,
+  struct ble_store_value_sec *values, size_t *count) {
+
+    int index = findSec(key, values, *count);
+    if (index == -1) { return BLE_HS_ENOENT; }
+
+    memmove(&values[index], &values[index + 1],
+      (*count - index - 1) * sizeof(values[0]));
+    (*count)--;
+
+    return 0;
+}
+
+
+///////////////////////////////
+// CCCD entries
+
+static int findCccd(const struct ble_store_key_cccd *key) {
+    int skipped = 0;
+
+    for (int i = 0; i < store.cccdCount; i++) {
+        const struct ble_store_value_cccd *value = &store.cccds[i];
+
+        if (ble_addr_cmp(&key->peer_addr, BLE_ADDR_ANY)) {
+            if (ble_addr_cmp(&value->peer_addr, &key->peer_addr)) {
+                continue;
+            }
+        }
+
+        if (key->chr_val_handle != 0) {
+            if (value->chr_val_handle != key->chr_val_handle) { continue; }
+        }
+
+        if (key->idx > skipped) {
+            skipped++;
+            continue;
+        }
+
+        return i;
+    }
+
+    return -1;
+}
+
+
+///////////////////////////////
+// NimBLE store callbacks (called from the NimBLE host task)
+
+static int storeRead(int objType, const union ble_store_key *key,
+  union ble_store_value *value) {
+
+    switch (objType) {
+        case BLE_STORE_OBJ_TYPE_OUR_SEC: {
+            int index = findSec(&key->sec, store.ourSecs, store.ourSecCount);
+            if (index == -1) { return BLE_HS_ENOENT; }
+            value->sec = store.ourSecs[index];
+
+            // The peer is resuming encryption with a stored LTK; keep it
+            // from being evicted. The order is persisted, or a reboot
+            // would restore the stale order (only written if it moved,
+            // so a repeat resume costs no flash write)
+            if (key->sec.ediv_rand_present &&
+              touchSec(store.ourSecs, store.ourSecCount, index)) {
+                save();
+            }
+            return 0;
+        }
+
+        case BLE_STORE_OBJ_TYPE_PEER_SEC: {
+            int index = findSec(&key->sec, store.peerSecs,
+              store.peerSecCount);
+            if (index == -1) { return BLE_HS_ENOENT; }
+            value->sec = store.peerSecs[index];
+            return 0;
+        }
+
+        case BLE_STORE_OBJ_TYPE_CCCD: {
+            int index = findCccd(&key->cccd);
+            if (index == -1) { return BLE_HS_ENOENT; }
+            value->cccd = store.cccds[index];
+            return 0;
+        }
+    }
+
+    return BLE_HS_ENOTSUP;
+}
+
+static int storeWrite(int objType, const union ble_store_value *value) {
+    int rc = BLE_HS_ENOTSUP;
+
+    switch (objType) {
+        case BLE_STORE_OBJ_TYPE_OUR_SEC:
+            rc = writeSec(&value->sec, store.ourSecs, &store.ourSecCount);
+            break;
+
+        case BLE_STORE_OBJ_TYPE_PEER_SEC:
+            rc = writeSec(&value->sec, store.peerSecs, &store.peerSecCount);
+            if (rc == 0) { pairingCount++; }
+            break;
+
+        case BLE_STORE_OBJ_TYPE_CCCD: {
+            struct ble_store_key_cccd key = { 0 };
+            ble_store_key_from_value_cccd(&key, &value->cccd);
+
+            int index = findCccd(&key);
+            if (index == -1) {
+                if (store.cccdCount >= MAX_CCCDS) {
+                    rc = BLE_HS_ESTORE_CAP;
+                    break;
+                }
+                index = store.cccdCount++;
+            }
+
+            store.cccds[index] = value->cccd;
+            rc = 0;
+            break;
+        }
+    }
+
+    if (rc == 0) { save(); }
+
+    return rc;
+}
+
+static int storeDelete(int objType, const union ble_store_key *key) {
+    int rc = BLE_HS_ENOTSUP;
+
+    switch (objType) {
+        case BLE_STORE_OBJ_TYPE_OUR_SEC:
+            rc = deleteSec(&key->sec, store.ourSecs, &store.ourSecCount);
+            break;
+
+        case BLE_STORE_OBJ_TYPE_PEER_SEC:
+            rc = deleteSec(&key->sec, store.peerSecs, &store.peerSecCount);
+            break;
+
+        case BLE_STORE_OBJ_TYPE_CCCD: {
+            int index = findCccd(&key->cccd);
+            if (index == -1) {
+                rc = BLE_HS_ENOENT;
+                break;
+            }
+
+            memmove(&store.cccds[index], &store.cccds[index + 1],
+              (store.cccdCount - index - 1) * sizeof(store.cccds[0]));
+            store.cccdCount--;
+            rc = 0;
+            break;
+        }
+    }
+
+    if (rc == 0) { save(); }
+
+    return rc;
+}
+
+
+///////////////////////////////
+// API
+
+void bonds_init() {
+    load();
+
+    ble_hs_cfg.store_read_cb = storeRead;
+    ble_hs_cfg.store_write_cb = storeWrite;
+    ble_hs_cfg.store_delete_cb = storeDelete;
+
+    // On overflow, evict the least-recently used peer
+    ble_hs_cfg.store_status_cb = ble_store_util_status_rr;
+
+    FFX_LOG("bonds loaded: peers=%d cccds=%d", store.peerSecCount,
+      store.cccdCount);
+}
+
+bool bonds_isBonded(const ble_addr_t *addr) {
+    struct ble_store_key_sec key = { 0 };
+    key.peer_addr = *addr;
+    return findSec(&key, store.ourSecs, store.ourSecCount) != -1;
+}
+
+uint32_t bonds_pairingCount() { return pairingCount; }
+
+void bonds_dump() {
+    FFX_LOG("bonds: ours=%d peers=%d cccds=%d pairings=%ld",
+      store.ourSecCount, store.peerSecCount, store.cccdCount, pairingCount);
+
+    for (int i = 0; i < store.peerSecCount; i++) {
+        const struct ble_store_value_sec *value = &store.peerSecs[i];
+        const uint8_t *a = value->peer_addr.val;
+        FFX_LOG("  bond %d: %02x:%02x:%02x:%02x:%02x:%02x type=%d sc=%d auth=%d",
+          i, a[5], a[4], a[3], a[2], a[1], a[0], value->peer_addr.type,
+          value->sc, value->authenticated);
+    }
+}
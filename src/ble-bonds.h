@@ -0,0 +1,46 @@
+#ifndef __BLE_BONDS_H__
+#define __BLE_BONDS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "host/ble_hs.h"
+
+
+// The number of peers the bond store keeps keys for; when full, the
+// least-recently used peer is evicted
+#define MAX_BONDS             (4)
+
+
+/**
+ *  Load the bond store from NVS and install it as the NimBLE host
+ *  store. The default NVS partition must already be initialized.
+ */
+void bonds_init();
+
+/**
+ *  Returns true if keys are stored for the peer identity %%addr%%.
+ */
+bool bonds_isBonded(const ble_addr_t *addr);
+
+/**
+ *  Returns the number of fresh pairings which have written keys to
+ *  the store, across all connections (for the stats).
+ */
+uint32_t bonds_pairingCount();
+
+/**
+ *  Dump the bond store to the console.
+ */
+void bonds_dump();
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __BLE_BONDS_H__ */
@@ -0,0 +1,62 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "esp_ds.h"
+
+#include "device-ds.h"
+#include "utils.h"
+
+
+#define ATTEST_HMAC_KEY         (HMAC_KEY2)
+
+// The expected duration of an RSA-3072 signature before one has been
+// measured; afterwards the last measured duration is used
+#define DEFAULT_DURATION        (30)
+
+
+static StaticSemaphore_t lockBuffer;
+static SemaphoreHandle_t lock = NULL;
+
+static uint32_t lastDuration = 0;
+
+
+void ds_init() {
+    if (lock) { return; }
+    // A mutex, so a lower-priority holder (e.g. a warm-up) inherits the
+    // priority of any task waiting to sign
+    lock = xSemaphoreCreateMutexStatic(&lockBuffer);
+}
+
+uint32_t ds_lastDuration() { return lastDuration; }
+
+// Sleep for most of the expected duration, then check once per tick, so
+// the waiting task neither spins nor oversleeps by much
+static void waitForDs() {
+    uint32_t expected = lastDuration ? lastDuration: DEFAULT_DURATION;
+    if (expected > 2) { delay(expected - 2); }
+    while (esp_ds_is_busy()) { vTaskDelay(1); }
+}
+
+bool ds_sign(uint8_t *sig, const uint8_t *hash, const void *cipherdata) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    uint32_t t0 = ticks();
+
+    esp_ds_context_t *ctx = NULL;
+    int ret = esp_ds_start_sign(hash, cipherdata, ATTEST_HMAC_KEY, &ctx);
+    if (ret) {
+        xSemaphoreGive(lock);
+        return false;
+    }
+
+    waitForDs();
+
+    ret = esp_ds_finish_sign(sig, ctx);
+
+    lastDuration = ticks() - t0;
+
+    xSemaphoreGive(lock);
+
+    return (ret == 0);
+}
@@ -0,0 +1,43 @@
+#ifndef __DEVICE_DS_H__
+#define __DEVICE_DS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// The length of the RSA-3072 signature (and of the padded hash input)
+#define DS_SIGNATURE_LENGTH     (384)
+
+
+/**
+ *  Initialize the DS (Digital Signature) peripheral access lock. Must be
+ *  called before [[ds_sign]].
+ */
+void ds_init();
+
+/**
+ *  Sign the PKCS#1 v1.5 padded %%hash%% (little-endian) with the key
+ *  protected by %%cipherdata%%, placing the (little-endian) signature
+ *  in %%sig%%.
+ *
+ *  The calling task sleeps while the peripheral works, so the CPU is
+ *  free for other tasks. The start and finish happen on the calling
+ *  task (the DS lock is owned by it).
+ */
+bool ds_sign(uint8_t *sig, const uint8_t *hash, const void *cipherdata);
+
+/**
+ *  Returns the duration (in ms) of the most recent signature.
+ */
+uint32_t ds_lastDuration();
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __DEVICE_DS_H__ */
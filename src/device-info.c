@@ -1,10 +1,15 @@
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "esp_ds.h"
 #include "esp_efuse.h"
 #include "esp_heap_caps.h"
 #include "esp_random.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 
 #include "firefly-bip32.h"
@@ -14,18 +19,20 @@
 #include "firefly-hash.h"
 #include "firefly-hollows.h"
 
-#include "utils.h"
-
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include "freertos/task.h"
 
 #include "esp_memory_utils.h"
 
+#include "device-ds.h"
+#include "device-public.h"
+#include "hollows.h"
+#include "utils.h"
+
 #define DEVICE_INFO_BLOCK   (EFUSE_BLK3)
 #define ATTEST_SLOT         (2)
 #define ATTEST_KEY_BLOCK    (EFUSE_BLK_KEY2)
-#define ATTEST_HMAC_KEY     (HMAC_KEY2)
 
 
 // Loaded from eFuses
@@ -39,8 +46,45 @@ static uint8_t attestProof[64] = { 0 };
 static uint8_t pubkeyN[384] = { 0 };
 esp_ds_data_t *cipherdata = NULL;
 
-static StaticSemaphore_t privkey0LockBuffer;
-static SemaphoreHandle_t privkey0Lock = NULL;
+// The keccak256 of the cipherdata; identifies the device key material
+static uint8_t cipherdigest[32] = { 0 };
+
+// A mutex (for priority inheritance) guarding the test key cache; it is
+// only held briefly, never across a derivation
+static StaticSemaphore_t testKeyLockBuffer;
+static SemaphoreHandle_t testKeyLock = NULL;
+
+// Incremented by ffx_deviceLock, so a derivation which began before a
+// lock does not repopulate the cache
+static uint32_t testKeyEpoch = 0;
+
+// The attestation prefix cache is bypassed until this is created
+static StaticSemaphore_t prefixLockBuffer;
+static SemaphoreHandle_t prefixLock = NULL;
+
+// Set once the NVS data load has been attempted (after status is set)
+static atomic_bool loaded = false;
+
+static StaticSemaphore_t loadLockBuffer;
+static SemaphoreHandle_t loadLock = NULL;
+
+// The test key cache; the m/44'/60' node is shared by every account, so
+// once it is known an account only needs three child derivations. This
+// lives in internal RAM (never PSRAM or flash) and is wiped by
+// ffx_deviceLock and on restart.
+static bool testNodeReady = false;
+static FfxHDNode testNode = { 0 };
+
+static bool privkey0Ready = false;
+static FfxEcPrivkey privkey0 = { 0 };
+
+static void wipeTestKeys() {
+    memset(&testNode, 0, sizeof(testNode));
+    testNodeReady = false;
+
+    memset(&privkey0, 0, sizeof(privkey0));
+    privkey0Ready = false;
+}
 
 static void reverseBytes(uint8_t *data, size_t length) {
     for (int i = 0; i < length / 2; i++) {
@@ -50,15 +94,20 @@ static void reverseBytes(uint8_t *data, size_t length) {
     }
 }
 
-int ffx_deviceModelNumber() { return modelNumber; }
-int ffx_deviceSerialNumber() { return serialNumber; }
+// The eFuse numbers are only reported once the NVS provisioning data
+// has loaded; until then the device is not known to be provisioned
+static bool isProvisioned() {
+    return atomic_load(&loaded) && status == FfxDeviceStatusOk;
+}
+
+int ffx_deviceModelNumber() { return isProvisioned() ? modelNumber: 0; }
+int ffx_deviceSerialNumber() { return isProvisioned() ? serialNumber: 0; }
 
-FfxDeviceStatus ffx_deviceStatus() { return status; }
 
 bool ffx_deviceModelName(char *output, size_t length) {
     if (length == 0) { return false; }
 
-    if (status != FfxDeviceStatusOk) {
+    if (!isProvisioned()) {
         snprintf(output, length, "[unprovisioned]");
         return false;
     }
@@ -75,50 +124,25 @@ bool ffx_deviceModelName(char *output, size_t length) {
     return true;
 }
 
-FfxDeviceStatus ffx_deviceInit() {
-    // Already loaded or failed to laod
-    if (status == FfxDeviceStatusOk || status != FfxDeviceStatusNotInitialized) {
-        return status;
-    }
-
-    // Semphore we use to provide async access to the account 0 test key
-    privkey0Lock = xSemaphoreCreateBinaryStatic(&privkey0LockBuffer);
-    xSemaphoreGive(privkey0Lock);
-
-    // Initialize the elliptic curve library, randomizing the points to
-    // mitigate side-channel attacks.
-    uint8_t tweak[32];
-    esp_fill_random(tweak, sizeof(tweak));
-    ffx_ec_init(tweak);
-    memset(tweak, 0, sizeof(tweak));
-
-    // Read eFuse info
-    uint32_t version = esp_efuse_read_reg(EFUSE_BLK3, 0);
-    uint32_t _modelNumber = esp_efuse_read_reg(EFUSE_BLK3, 1);
-    uint32_t _serialNumber = esp_efuse_read_reg(EFUSE_BLK3, 2);
-
-    // Invalid eFuse info
-    if (version != 0x00000001 || _modelNumber == 0 || _serialNumber == 0) {
-        status = FfxDeviceStatusMissingEfuse;
-        return status;
-    }
+// Load the provisioning data from the attest NVS partition; this is
+// only needed for attestation (and the test keys), so it is deferred
+// until first use (or a background load) to keep it off the boot path
+static FfxDeviceStatus loadNvs() {
 
     // Open the NVS partition
     nvs_handle_t nvs;
     {
         int ret = nvs_flash_init_partition("attest");
         if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-            status = FfxDeviceStatusMissingNvs;
-            return status;
+            return FfxDeviceStatusMissingNvs;
         }
 
         ret = nvs_open_from_partition("attest", "secure", NVS_READONLY, &nvs);
-        if (ret) {
-            status = FfxDeviceStatusMissingNvs;
-            return status;
-        }
+        if (ret) { return FfxDeviceStatusMissingNvs; }
     }
 
+    FfxDeviceStatus result = FfxDeviceStatusMissingNvs;
+
     // Load the cipherdata
     {
         size_t olen = sizeof(esp_ds_data_t);
@@ -129,34 +153,115 @@ FfxDeviceStatus ffx_deviceInit() {
         if (ret || olen != sizeof(esp_ds_data_t)) {
             free(cipherdata);
             cipherdata = NULL;
-            status = FfxDeviceStatusMissingNvs;
-            return status;
+            goto done;
         }
+
+        ffx_hash_keccak256(cipherdigest, (uint8_t*)cipherdata,
+          sizeof(esp_ds_data_t));
     }
 
     // Load the attest proof
     {
         size_t olen = 64;
         int ret = nvs_get_blob(nvs, "attest", attestProof, &olen);
-        if (ret || olen != 64) {
-            status = FfxDeviceStatusMissingNvs;
-            return status;
-        }
+        if (ret || olen != 64) { goto done; }
     }
 
     // Load the RSA public key
     {
         size_t olen = 384;
         int ret = nvs_get_blob(nvs, "pubkey-n", pubkeyN, &olen);
-        if (ret || olen != 384) {
-            status = FfxDeviceStatusMissingNvs;
-            return status;
+        if (ret || olen != 384) { goto done; }
+    }
+
+    result = FfxDeviceStatusOk;
+
+done:
+    nvs_close(nvs);
+
+    return result;
+}
+
+// Ensures the NVS provisioning data has been loaded (blocking if another
+// task is currently loading it) and returns the device status
+static FfxDeviceStatus ensureLoaded() {
+    if (status || loaded) { return status; }
+
+    xSemaphoreTake(loadLock, portMAX_DELAY);
+
+    if (!loaded) {
+        boot_begin(BootPhaseDeviceLoad);
+
+        FfxDeviceStatus result = loadNvs();
+        if (result) {
+            FFX_LOG("failed to load provisioning data: status=%d", result);
+            status = result;
+        } else {
+            // The public data derived from this cipherdata (if any)
+            public_load(cipherdigest);
         }
+
+        loaded = true;
+
+        boot_end(BootPhaseDeviceLoad);
+    }
+
+    xSemaphoreGive(loadLock);
+
+    return status;
+}
+
+void ffx_deviceLoad() {
+    ensureLoaded();
+}
+
+FfxDeviceStatus ffx_deviceStatus() { return ensureLoaded(); }
+
+FfxDeviceStatus ffx_deviceInit() {
+    // Already loaded or failed to laod
+    if (status == FfxDeviceStatusOk || status != FfxDeviceStatusNotInitialized) {
+        return status;
+    }
+
+    // Mutex we use to provide async access to the test key cache
+    testKeyLock = xSemaphoreCreateMutexStatic(&testKeyLockBuffer);
+
+    // Never leave the cached test keys in RAM across a restart
+    esp_register_shutdown_handler(wipeTestKeys);
+
+    // Lock for the DS peripheral
+    ds_init();
+
+    // Mutex for the attestation prefix cache; like the others, this is
+    // taken by warm-ups (on the prime task), so a waiting Panel or job
+    // lends the holder its priority
+    prefixLock = xSemaphoreCreateMutexStatic(&prefixLockBuffer);
+
+    // Mutex for loading the NVS data
+    loadLock = xSemaphoreCreateMutexStatic(&loadLockBuffer);
+
+    // Initialize the elliptic curve library, randomizing the points to
+    // mitigate side-channel attacks.
+    uint8_t tweak[32];
+    esp_fill_random(tweak, sizeof(tweak));
+    ffx_ec_init(tweak);
+    memset(tweak, 0, sizeof(tweak));
+
+    // Read eFuse info
+    uint32_t version = esp_efuse_read_reg(EFUSE_BLK3, 0);
+    uint32_t _modelNumber = esp_efuse_read_reg(EFUSE_BLK3, 1);
+    uint32_t _serialNumber = esp_efuse_read_reg(EFUSE_BLK3, 2);
+
+    // Invalid eFuse info
+    if (version != 0x00000001 || _modelNumber == 0 || _serialNumber == 0) {
+        status = FfxDeviceStatusMissingEfuse;
+        return status;
     }
 
     serialNumber = _serialNumber;
     modelNumber = _modelNumber;
 
+    // The NVS data is loaded on first use (see ensureLoaded)
     status = FfxDeviceStatusOk;
     return status;
 }
@@ -169,15 +274,20 @@ const char PKCS_PREFIX[] = {
 };
 
 
+// Attestation versions; this is included in the signed data so a batch
+// root cannot be presented as the hash of a single payload
+#define ATTEST_VERSION          (1)
+#define ATTEST_VERSION_BATCH    (2)
+
 // The top bit of nonce should be:
 // - 0 for extenal API usage
 // - 1 for less-insecure purposes used internally
-static FfxDeviceStatus _device_attest(uint8_t *challenge, uint8_t *nonce,
-  FfxDeviceAttestation *attest) {
+static FfxDeviceStatus _device_attest(uint8_t version, uint8_t *challenge,
+  uint8_t *nonce, FfxDeviceAttestation *attest) {
 
-    if (status) { return status; }
+    if (ensureLoaded()) { return status; }
 
-    attest->version = 1;
+    attest->version = version;
     attest->modelNumber = modelNumber;
     attest->serialNumber = serialNumber;
 
@@ -193,7 +303,7 @@ static FfxDeviceStatus _device_attest(uint8_t *challenge, uint8_t *nonce,
         size_t offset = 0;
 
         // Version
-        attestation[offset++] = 1;
+        attestation[offset++] = version;
 
         // Nonce
         memcpy(&attestation[offset], nonce, 16);
@@ -239,30 +349,8 @@ static FfxDeviceStatus _device_attest(uint8_t *challenge, uint8_t *nonce,
 
     uint8_t sig[384] = { 0 };
 
-    // Sync version
-    int ret = esp_ds_sign(hash, cipherdata, ATTEST_HMAC_KEY, sig);
-    if (ret) { return FfxDeviceStatusFailed; }
-
-    /*
-
-    // Async version
-    printf("AA1: %ld %d\n", ticks(), uxTaskPriorityGet(NULL));
-    esp_ds_context_t *signCtx = NULL;
-    int ret = esp_ds_start_sign(hash, cipherdata, ATTEST_HMAC_KEY, &signCtx);
-    if (ret) {
-        printf("RET1: %d\n", ret);
-        return FfxDeviceStatusFailed;
-    }
-    printf("AA2: %ld\n", ticks());
-    while(esp_ds_is_busy()) { delay(10); }
-    printf("AA3: %ld\n", ticks());
-    ret = esp_ds_finish_sign(sig, signCtx);
-    if (ret) {
-        printf("RET2: %d\n", ret);
-        return FfxDeviceStatusFailed;
-    }
-    printf("AA4: %ld\n", ticks());
-    */
+    // The calling task sleeps while the DS peripheral works
+    if (!ds_sign(sig, hash, cipherdata)) { return FfxDeviceStatusFailed; }
 
     reverseBytes(sig, sizeof(sig));
 
@@ -274,173 +362,691 @@ static FfxDeviceStatus _device_attest(uint8_t *challenge, uint8_t *nonce,
 
 // @TODO: Type checking should be added to everything
 
-static bool setValue(uint8_t *data, FfxCborCursor *cursor) {
-    if (!ffx_cbor_checkType(cursor, FfxCborTypeData)) { return false; }
-    FfxDataResult value = ffx_cbor_getData(cursor);
-    if (value.length > 32) { return false; }
-    memset(data, 0, 32 - value.length);
-    memcpy(&data[32 - value.length], value.bytes, value.length);
-    return true;
+#define SPACE         (0)
+#define OPEN_PAREN    (1)
+#define CLOSE_PAREN   (2)
+#define COMMA         (3)
+const uint8_t chars[] = { 32, 40, 41, 44 };
+
+
+// Finds the values for each of %%keys%% in a single pass over %%map%%,
+// stopping once all are found. Returns false if any key is missing.
+static bool indexMap(FfxCborCursor *values, const FfxCborCursor *map,
+  const char* const* keys, size_t count) {
+
+    uint32_t remaining = (1 << count) - 1;
+
+    FfxCborIterator iter = ffx_cbor_iterate(map);
+    while (remaining && ffx_cbor_nextChild(&iter)) {
+        FfxDataResult key = ffx_cbor_getData(&iter.key);
+
+        for (int i = 0; i < count; i++) {
+            if ((remaining & (1 << i)) == 0) { continue; }
+            if (key.length != strlen(keys[i])) { continue; }
+            if (memcmp(key.bytes, keys[i], key.length)) { continue; }
+
+            values[i] = iter.child;
+            remaining &= ~(1 << i);
+            break;
+        }
+    }
+
+    return (remaining == 0);
 }
 
-// scratch[0:32] = keccak256(scratch[0:32] ++ cursor)
-static bool accumulate(uint8_t *scratch, FfxCborCursor *cursor) {
-    if (!setValue(&scratch[32], cursor)) { return false; }
+///////////////////////////////
+// Prefix cache
+
+// The number of prefixes cached; attestations tend to be for a small
+// number of contracts and actions
+#define PREFIX_CACHE_SIZE     (8)
+
+// The prefix is keccak-chained over the version (which must be 1, so it
+// is not part of the key), the domain chainId and contract and the hash
+// of the action signature string; entries are keyed on the raw signature
+// string so a hit does not need to hash it
+typedef struct PrefixEntry {
+    uint8_t chainId[32];
+    uint8_t contract[32];
+    uint8_t signature[FFX_ATTEST_MAX_SIGNATURE];
+    size_t signatureLength;
+    uint8_t prefix[32];
+} PrefixEntry;
+
+// Entries are kept in least-recently used order (index 0 is evicted)
+static PrefixEntry prefixCache[PREFIX_CACHE_SIZE];
+static size_t prefixCount = 0;
+
+static uint32_t prefixHits = 0;
+static uint32_t prefixMisses = 0;
+
+// scratch[0:32] = prefix
+static void computePrefix(uint8_t *scratch, const uint8_t *chainId,
+  const uint8_t *contract, const uint8_t *signatureHash) {
+
+    memset(scratch, 0, 32);
+    scratch[31] = 1;
+
+    memcpy(&scratch[32], chainId, 32);
     ffx_hash_keccak256(scratch, scratch, 64);
-    return true;
+
+    memcpy(&scratch[32], contract, 32);
+    ffx_hash_keccak256(scratch, scratch, 64);
+
+    memcpy(&scratch[32], signatureHash, 32);
+    ffx_hash_keccak256(scratch, scratch, 64);
+
+    scratch[32] = 0;
+    ffx_hash_keccak256(scratch, scratch, 33);
 }
 
+// Copies the cached prefix for %%hasher%% into scratch[0:32] and marks
+// it most-recently used, returning false if not cached. Caller must own
+// the lock.
+static bool findPrefix(uint8_t *scratch, const FfxAttestHasher *hasher) {
+    for (int i = prefixCount - 1; i >= 0; i--) {
+        PrefixEntry *entry = &prefixCache[i];
+
+        if (entry->signatureLength != hasher->signatureLength) { continue; }
+        if (memcmp(entry->signature, hasher->signature,
+          hasher->signatureLength)) {
+            continue;
+        }
+        if (memcmp(entry->chainId, hasher->chainId, 32)) { continue; }
+        if (memcmp(entry->contract, hasher->contract, 32)) { continue; }
 
-#define SPACE         (0)
-#define OPEN_PAREN    (1)
-#define CLOSE_PAREN   (2)
-#define COMMA         (3)
-const uint8_t chars[] = { 32, 40, 41, 44 };
+        memcpy(scratch, entry->prefix, 32);
 
+        // Move to the end (most-recently used)
+        PrefixEntry hit = *entry;
+        memmove(entry, entry + 1, (prefixCount - i - 1) * sizeof(hit));
+        prefixCache[prefixCount - 1] = hit;
 
-static bool computePrefix(uint8_t *scratch, const FfxCborCursor *cursor) {
-    FfxCborCursor follow;
+        return true;
+    }
 
-    {
-        follow = ffx_cbor_followKey(cursor, "version");
-        FfxValueResult value = ffx_cbor_getValue(&follow);
-        if (value.value != 1) { return false; }
-        scratch[31] = 1;
+    return false;
+}
+
+// scratch[0:32] = prefix, using the cache if possible
+static void getPrefix(uint8_t *scratch, FfxAttestHasher *hasher) {
+    uint8_t signatureHash[32];
+
+    // Too long to buffer; the signature was streamed into the context
+    if (hasher->signatureLength > FFX_ATTEST_MAX_SIGNATURE) {
+        ffx_hash_finalKeccak256(&hasher->ctx, signatureHash);
+        computePrefix(scratch, hasher->chainId, hasher->contract,
+          signatureHash);
+        return;
     }
 
-    setValue(scratch, &follow);
+    if (prefixLock != NULL) {
+        xSemaphoreTake(prefixLock, portMAX_DELAY);
 
-    {
-        FfxCborCursor domain = ffx_cbor_followKey(cursor, "domain");
-        follow = ffx_cbor_followKey(&domain, "chainId");
-        if (!accumulate(scratch, &follow)) { return false; }
+        bool found = findPrefix(scratch, hasher);
+        if (found) { prefixHits++; } else { prefixMisses++; }
 
-        follow = ffx_cbor_followKey(&domain, "contract");
-        if (!accumulate(scratch, &follow)) { return false; }
+        xSemaphoreGive(prefixLock);
+
+        if (found) { return; }
     }
 
-    // action ++ "(" ++ params.map(`type name`).join(",") ++ ")"
-    {
-        FfxKeccak256Context ctx;
-        ffx_hash_initKeccak256(&ctx);
+    ffx_hash_keccak256(signatureHash, hasher->signature,
+      hasher->signatureLength);
+    computePrefix(scratch, hasher->chainId, hasher->contract,
+      signatureHash);
 
-        follow = ffx_cbor_followKey(cursor, "action");
-        FfxDataResult value = ffx_cbor_getData(&follow);// @TODO:check type
-        ffx_hash_updateKeccak256(&ctx, value.bytes, value.length);
+    if (prefixLock == NULL) { return; }
 
-        // "("
-        ffx_hash_updateKeccak256(&ctx, &chars[OPEN_PAREN], 1);
+    xSemaphoreTake(prefixLock, portMAX_DELAY);
 
-        bool first = true;
+    // Another task may have added it while the lock was released
+    uint8_t cached[32];
+    if (findPrefix(cached, hasher)) {
+        xSemaphoreGive(prefixLock);
+        return;
+    }
 
-        FfxCborCursor params = ffx_cbor_followKey(cursor, "params");
-        FfxCborIterator iter = ffx_cbor_iterate(&params);
-        while (ffx_cbor_nextChild(&iter)) {
+    // Evict the least-recently used
+    if (prefixCount == PREFIX_CACHE_SIZE) {
+        memmove(prefixCache, &prefixCache[1],
+          (PREFIX_CACHE_SIZE - 1) * sizeof(PrefixEntry));
+        prefixCount--;
+    }
+
+    PrefixEntry *entry = &prefixCache[prefixCount++];
+    memcpy(entry->chainId, hasher->chainId, 32);
+    memcpy(entry->contract, hasher->contract, 32);
+    memcpy(entry->signature, hasher->signature, hasher->signatureLength);
+    entry->signatureLength = hasher->signatureLength;
+    memcpy(entry->prefix, scratch, 32);
+
+    xSemaphoreGive(prefixLock);
+}
+
+void ffx_deviceDumpStats() {
+    FFX_LOG("attest prefix cache: entries=%d hits=%ld misses=%ld",
+      prefixCount, prefixHits, prefixMisses);
+
+    public_dump();
+}
 
-            // ","
-            if (!first) {
-                ffx_hash_updateKeccak256(&ctx, &chars[OPEN_PAREN], 1);
-            }
-            first = false;
 
-            // type
-            follow = ffx_cbor_followKey(&iter.child, "type");
-            value = ffx_cbor_getData(&follow);
-            ffx_hash_updateKeccak256(&ctx, value.bytes, value.length);
+///////////////////////////////
+// Attestation hashing
 
-            // " "
-            ffx_hash_updateKeccak256(&ctx, &chars[SPACE], 1);
+// Hasher phases
+#define PHASE_FAILED          (0)
+#define PHASE_PARAMS          (1)
+#define PHASE_VALUES          (2)
+#define PHASE_DONE            (3)
 
-            // name
-            follow = ffx_cbor_followKey(&iter.child, "name");
-            value = ffx_cbor_getData(&follow);
-            ffx_hash_updateKeccak256(&ctx, value.bytes, value.length);
+static bool fail(FfxAttestHasher *hasher) {
+    hasher->phase = PHASE_FAILED;
+    return false;
+}
+
+static bool isDynamic(FfxAttestHasher *hasher, size_t index) {
+    return (hasher->dynamic[index / 8] & (1 << (index % 8))) != 0;
+}
+
+// word = data (left-padded)
+static bool setWord(uint8_t *word, const uint8_t *data, size_t length) {
+    if (length > 32) { return false; }
+    memset(word, 0, 32 - length);
+    memcpy(&word[32 - length], data, length);
+    return true;
+}
+
+// Prepare for the value of the next param
+static void beginValue(FfxAttestHasher *hasher) {
+    hasher->valueLength = 0;
+
+    if (hasher->valueCount < hasher->paramCount &&
+      isDynamic(hasher, hasher->valueCount)) {
+        ffx_hash_initKeccak256(&hasher->ctx);
+    }
+}
+
+// Append %%data%% to the action signature string, which is buffered for
+// the prefix cache until it no longer fits, then streamed into Keccak256
+static void appendSignature(FfxAttestHasher *hasher, const uint8_t *data,
+  size_t length) {
+
+    if (hasher->signatureLength <= FFX_ATTEST_MAX_SIGNATURE) {
+        size_t offset = hasher->signatureLength;
+        if (offset + length <= FFX_ATTEST_MAX_SIGNATURE) {
+            memcpy(&hasher->signature[offset], data, length);
+            hasher->signatureLength += length;
+            return;
         }
 
-        // ")"
-        ffx_hash_updateKeccak256(&ctx, &chars[CLOSE_PAREN], 1);
+        ffx_hash_initKeccak256(&hasher->ctx);
+        ffx_hash_updateKeccak256(&hasher->ctx, hasher->signature, offset);
+        hasher->signatureLength = FFX_ATTEST_MAX_SIGNATURE + 1;
+    }
+
+    ffx_hash_updateKeccak256(&hasher->ctx, data, length);
+}
+
+bool ffx_attestInit(FfxAttestHasher *hasher, const uint8_t *chainId,
+  size_t chainIdLength, const uint8_t *contract, size_t contractLength,
+  const uint8_t *action, size_t actionLength) {
 
-        ffx_hash_finalKeccak256(&ctx, &scratch[32]);
+    memset(hasher, 0, sizeof(FfxAttestHasher));
 
-        ffx_hash_keccak256(scratch, scratch, 64);
+    if (!setWord(hasher->chainId, chainId, chainIdLength)) {
+        return fail(hasher);
     }
 
-    scratch[32] = 0;
-    ffx_hash_keccak256(scratch, scratch, 33);
+    if (!setWord(hasher->contract, contract, contractLength)) {
+        return fail(hasher);
+    }
+
+    // action ++ "(" ++ params.map(`type name`).join(",") ++ ")"
+
+    appendSignature(hasher, action, actionLength);
+
+    // "("
+    appendSignature(hasher, &chars[OPEN_PAREN], 1);
+
+    hasher->phase = PHASE_PARAMS;
 
     return true;
 }
 
-static bool hashAttest(uint8_t *scratch, const FfxCborCursor *cursor) {
+bool ffx_attestAppendParam(FfxAttestHasher *hasher, const uint8_t *type,
+  size_t typeLength, const uint8_t *name, size_t nameLength) {
+
+    if (hasher->phase != PHASE_PARAMS) { return fail(hasher); }
+    if (hasher->paramCount == FFX_ATTEST_MAX_PARAMS) { return fail(hasher); }
+
+    // "," (the separator is an open paren in the existing hashes)
+    if (hasher->paramCount) {
+        appendSignature(hasher, &chars[OPEN_PAREN], 1);
+    }
+
+    // type
+    appendSignature(hasher, type, typeLength);
+
+    // " "
+    appendSignature(hasher, &chars[SPACE], 1);
+
+    // name
+    appendSignature(hasher, name, nameLength);
+
+    // Strings and Bytes get compressed via keccak256
+    bool dynamic = false;
+    if (typeLength == 5) {
+        if (memcmp(type, "bytes", 5) == 0) {
+            dynamic = true;
+        } else if (memcmp(type, "string", 5) == 0) {
+            dynamic = true;
+        }
+    }
+
+    size_t index = hasher->paramCount++;
+    if (dynamic) { hasher->dynamic[index / 8] |= (1 << (index % 8)); }
+
+    return true;
+}
+
+bool ffx_attestBeginValues(FfxAttestHasher *hasher, const uint8_t *salt) {
+    if (hasher->phase != PHASE_PARAMS) { return fail(hasher); }
+
+    // ")"
+    appendSignature(hasher, &chars[CLOSE_PAREN], 1);
 
     // Prefix
-    if (!computePrefix(scratch, cursor)) { return false; }
+    getPrefix(hasher->scratch, hasher);
 
     // Salt
-    FfxCborCursor follow = ffx_cbor_followKey(cursor, "salt");
-    FfxDataResult value = ffx_cbor_getData(&follow);
+    memcpy(&hasher->scratch[32], salt, 32);
+    ffx_hash_keccak256(hasher->scratch, hasher->scratch, 64);
 
-    if (!ffx_cbor_checkType(&follow, FfxCborTypeData) || value.length != 32) {
+    hasher->phase = PHASE_VALUES;
+    beginValue(hasher);
+
+    return true;
+}
+
+bool ffx_attestUpdateValue(FfxAttestHasher *hasher, const uint8_t *data,
+  size_t length) {
+
+    if (hasher->phase != PHASE_VALUES) { return fail(hasher); }
+    if (hasher->valueCount == hasher->paramCount) { return fail(hasher); }
+
+    if (isDynamic(hasher, hasher->valueCount)) {
+        ffx_hash_updateKeccak256(&hasher->ctx, data, length);
+
+    } else {
+        if (hasher->valueLength + length > 32) { return fail(hasher); }
+        memcpy(&hasher->scratch[32 + hasher->valueLength], data, length);
+    }
+
+    hasher->valueLength += length;
+
+    return true;
+}
+
+bool ffx_attestEndValue(FfxAttestHasher *hasher) {
+    if (hasher->phase != PHASE_VALUES) { return fail(hasher); }
+    if (hasher->valueCount == hasher->paramCount) { return fail(hasher); }
+
+    uint8_t *word = &hasher->scratch[32];
+
+    if (isDynamic(hasher, hasher->valueCount)) {
+        ffx_hash_finalKeccak256(&hasher->ctx, word);
+
+    } else {
+        // Left-pad the value
+        size_t length = hasher->valueLength;
+        memmove(&word[32 - length], word, length);
+        memset(word, 0, 32 - length);
+    }
+
+    ffx_hash_keccak256(hasher->scratch, hasher->scratch, 64);
+
+    hasher->valueCount++;
+    beginValue(hasher);
+
+    return true;
+}
+
+bool ffx_attestFinal(FfxAttestHasher *hasher, uint8_t *digestOut) {
+    if (hasher->phase != PHASE_VALUES) { return fail(hasher); }
+    if (hasher->valueCount != hasher->paramCount) { return fail(hasher); }
+
+    hasher->scratch[32] = 0;
+    ffx_hash_keccak256(hasher->scratch, hasher->scratch, 33);
+
+    memcpy(digestOut, hasher->scratch, 32);
+
+    hasher->phase = PHASE_DONE;
+
+    return true;
+}
+
+// The number of param value cursors kept on the stack; larger payloads
+// use the heap
+#define STACK_PARAMS      (4)
+
+// The payload is walked once: the top-level and domain keys are indexed
+// in a single pass each, and the params are walked once, feeding their
+// type and name to the hasher while keeping a cursor to each value
+// (which can only be hashed once the signature is complete)
+static bool hashAttest(uint8_t *scratch, const FfxCborCursor *cursor) {
+
+    static const char* const payloadKeys[] = {
+        "version", "domain", "action", "params", "salt"
+    };
+    enum {
+        PAYLOAD_VERSION, PAYLOAD_DOMAIN, PAYLOAD_ACTION, PAYLOAD_PARAMS,
+        PAYLOAD_SALT
+    };
+
+    static const char* const domainKeys[] = { "chainId", "contract" };
+    enum { DOMAIN_CHAIN_ID, DOMAIN_CONTRACT };
+
+    static const char* const paramKeys[] = { "type", "name", "value" };
+    enum { PARAM_TYPE, PARAM_NAME, PARAM_VALUE };
+
+    FfxCborCursor payload[5];
+    if (!indexMap(payload, cursor, payloadKeys, 5)) { return false; }
+
+    FfxCborCursor domain[2];
+    if (!indexMap(domain, &payload[PAYLOAD_DOMAIN], domainKeys, 2)) {
         return false;
     }
 
-    memcpy(&scratch[32], value.bytes, 32);
-    ffx_hash_keccak256(scratch, scratch, 64);
+    {
+        FfxValueResult value = ffx_cbor_getValue(&payload[PAYLOAD_VERSION]);
+        if (value.value != 1) { return false; }
+    }
 
-    // Parameters:
-    FfxCborCursor params = ffx_cbor_followKey(cursor, "params");
-    FfxCborIterator iter = ffx_cbor_iterate(&params);
+    if (!ffx_cbor_checkType(&domain[DOMAIN_CHAIN_ID], FfxCborTypeData) ||
+      !ffx_cbor_checkType(&domain[DOMAIN_CONTRACT], FfxCborTypeData)) {
+        return false;
+    }
+
+    FfxAttestHasher hasher;
+
+    {
+        FfxDataResult chainId = ffx_cbor_getData(&domain[DOMAIN_CHAIN_ID]);
+        FfxDataResult contract = ffx_cbor_getData(&domain[DOMAIN_CONTRACT]);
+
+        // @TODO:check type
+        FfxDataResult action = ffx_cbor_getData(&payload[PAYLOAD_ACTION]);
+
+        if (!ffx_attestInit(&hasher, chainId.bytes, chainId.length,
+          contract.bytes, contract.length, action.bytes, action.length)) {
+            return false;
+        }
+    }
+
+    FfxCborCursor stackValues[STACK_PARAMS];
+    FfxCborCursor *values = stackValues;
+    size_t capacity = STACK_PARAMS;
+    size_t count = 0;
+
+    bool success = false;
+
+    FfxCborIterator iter = ffx_cbor_iterate(&payload[PAYLOAD_PARAMS]);
     while (ffx_cbor_nextChild(&iter)) {
-        // Type
-        follow = ffx_cbor_followKey(&iter.child, "type");
-        value = ffx_cbor_getData(&follow);
-
-        // Strings and Bytes get compressed via keccak256
-        bool dynamic = false;
-        if (value.length == 5) {
-            if (memcmp(value.bytes, "bytes", 5) == 0) {
-                dynamic = true;
-            } else if (memcmp(value.bytes, "string", 5) == 0) {
-                dynamic = true;
-            }
+        FfxCborCursor param[3];
+        if (!indexMap(param, &iter.child, paramKeys, 3)) { goto done; }
+
+        FfxDataResult type = ffx_cbor_getData(&param[PARAM_TYPE]);
+        FfxDataResult name = ffx_cbor_getData(&param[PARAM_NAME]);
+        if (!ffx_attestAppendParam(&hasher, type.bytes, type.length,
+          name.bytes, name.length)) {
+            goto done;
         }
 
-        // Value
-        follow = ffx_cbor_followKey(&iter.child, "value");
-        value = ffx_cbor_getData(&follow);
+        if (count == capacity) {
+            capacity *= 2;
+            FfxCborCursor *grown = malloc(capacity * sizeof(FfxCborCursor));
+            if (grown == NULL) { goto done; }
+            memcpy(grown, values, count * sizeof(FfxCborCursor));
+            if (values != stackValues) { free(values); }
+            values = grown;
+        }
 
-        if (dynamic) {
-            ffx_hash_keccak256(&scratch[32], value.bytes, value.length);
-        } else {
-            if (value.length > 32) { return false; }
-            memset(&scratch[32], 0, 32 - value.length);
-            memcpy(&scratch[64 - value.length], value.bytes, value.length);
+        values[count++] = param[PARAM_VALUE];
+    }
+
+    // Salt
+    {
+        FfxDataResult salt = ffx_cbor_getData(&payload[PAYLOAD_SALT]);
+
+        if (!ffx_cbor_checkType(&payload[PAYLOAD_SALT], FfxCborTypeData) ||
+          salt.length != 32) {
+            goto done;
         }
 
-        ffx_hash_keccak256(scratch, scratch, 64);
+        if (!ffx_attestBeginValues(&hasher, salt.bytes)) { goto done; }
     }
 
-    scratch[32] = 0;
-    ffx_hash_keccak256(scratch, scratch, 33);
+    // Parameters:
+    for (int i = 0; i < count; i++) {
+        FfxDataResult value = ffx_cbor_getData(&values[i]);
+        if (!ffx_attestUpdateValue(&hasher, value.bytes, value.length)) {
+            goto done;
+        }
+        if (!ffx_attestEndValue(&hasher)) { goto done; }
+    }
 
-    return true;
-}
+    success = ffx_attestFinal(&hasher, scratch);
 
-bool ffx_deviceAttest(FfxDeviceAttestation *attestOut,
-  const FfxCborCursor *payload) {
+done:
+    if (values != stackValues) { free(values); }
 
-    // Create a random nonce
-    uint8_t nonce[16];
+    return success;
+}
+
+// Create a random external nonce
+static void createNonce(uint8_t *nonce) {
     esp_fill_random(nonce, 16);
 
     // We reserve the top bit being set for internal usage so that
     // the external API cannot expose internal values.
     nonce[0] &= 0x7f;
+}
+
+bool ffx_deviceAttest(FfxDeviceAttestation *attestOut,
+  const FfxCborCursor *payload) {
+
+    uint8_t nonce[16];
+    createNonce(nonce);
 
     uint8_t scratch[64] = { 0 };
     if (!hashAttest(scratch, payload)) { return false; }
 
-    return (_device_attest(scratch, nonce, attestOut) == FfxDeviceStatusOk);
+    return (_device_attest(ATTEST_VERSION, scratch, nonce, attestOut) ==
+      FfxDeviceStatusOk);
+}
+
+
+///////////////////////////////
+// Batch attestation
+
+// Merkle tree nodes (domain-separated from each other):
+//   leaf = keccak256(0x00 ++ hashAttest(payload))
+//   node = keccak256(0x01 ++ left ++ right)
+// A node without a sibling (the last on an odd-length level) is promoted
+// to the next level unchanged.
+
+static void hashLeaf(uint8_t *leafOut, const uint8_t *digest) {
+    uint8_t data[1 + 32];
+    data[0] = 0x00;
+    memcpy(&data[1], digest, 32);
+    ffx_hash_keccak256(leafOut, data, sizeof(data));
+}
+
+static void hashNode(uint8_t *nodeOut, const uint8_t *left,
+  const uint8_t *right) {
+    uint8_t data[1 + 32 + 32];
+    data[0] = 0x01;
+    memcpy(&data[1], left, 32);
+    memcpy(&data[33], right, 32);
+    ffx_hash_keccak256(nodeOut, data, sizeof(data));
+}
+
+bool ffx_deviceAttestBatch(FfxDeviceAttestation *attestOut,
+  FfxAttestProof *proofsOut, const FfxCborCursor *payloads, size_t count) {
+
+    if (count == 0 || count > FFX_ATTEST_BATCH_MAX) { return false; }
+
+    uint8_t (*nodes)[32] = malloc(count * 32);
+    if (nodes == NULL) { return false; }
+
+    // Leaves
+    for (int i = 0; i < count; i++) {
+        uint8_t scratch[64] = { 0 };
+        if (!hashAttest(scratch, &payloads[i])) {
+            free(nodes);
+            return false;
+        }
+
+        hashLeaf(nodes[i], scratch);
+
+        proofsOut[i].index = i;
+        proofsOut[i].count = count;
+        proofsOut[i].depth = 0;
+    }
+
+    // Reduce each level in-place, collecting each leaf's sibling first
+    size_t length = count;
+    for (int level = 0; length > 1; level++) {
+        for (int i = 0; i < count; i++) {
+            size_t sibling = (i >> level) ^ 1;
+            if (sibling >= length) { continue; }
+
+            FfxAttestProof *proof = &proofsOut[i];
+            memcpy(proof->path[proof->depth++], nodes[sibling], 32);
+        }
+
+        for (int i = 0; i < length / 2; i++) {
+            hashNode(nodes[i], nodes[2 * i], nodes[2 * i + 1]);
+        }
+
+        if (length & 1) {
+            memmove(nodes[length / 2], nodes[length - 1], 32);
+        }
+
+        length = (length + 1) / 2;
+    }
+
+    uint8_t root[32];
+    memcpy(root, nodes[0], 32);
+    free(nodes);
+
+    uint8_t nonce[16];
+    createNonce(nonce);
+
+    return (_device_attest(ATTEST_VERSION_BATCH, root, nonce, attestOut) ==
+      FfxDeviceStatusOk);
+}
+
+bool ffx_verifyAttestProof(const uint8_t *root, const uint8_t *digest,
+  const FfxAttestProof *proof) {
+
+    if (proof->index >= proof->count) { return false; }
+    if (proof->depth > FFX_ATTEST_PROOF_DEPTH) { return false; }
+
+    uint8_t node[32];
+    hashLeaf(node, digest);
+
+    size_t index = proof->index;
+    size_t length = proof->count;
+    size_t depth = 0;
+
+    while (length > 1) {
+        size_t sibling = index ^ 1;
+        if (sibling < length) {
+            if (depth == proof->depth) { return false; }
+
+            if (index & 1) {
+                hashNode(node, proof->path[depth], node);
+            } else {
+                hashNode(node, node, proof->path[depth]);
+            }
+            depth++;
+        }
+
+        index >>= 1;
+        length = (length + 1) / 2;
+    }
+
+    return (depth == proof->depth && memcmp(node, root, 32) == 0);
+}
+
+
+///////////////////////////////
+// Async attestation
+
+// Runs on the job worker; owns (and frees) the request
+typedef struct AttestJob {
+    uint8_t challenge[32];
+    uint8_t nonce[16];
+    int panelId;
+    FfxDeviceAttestation *attestOut;
+    FfxDeviceAttestation attest;
+} AttestJob;
+
+static bool attestJob(int id, void *arg) {
+    AttestJob *job = arg;
+
+    bool success = false;
+
+    if (!ffx_isJobCancelled(id)) {
+        FfxDeviceStatus result = _device_attest(ATTEST_VERSION,
+          job->challenge, job->nonce, &job->attest);
+
+        // Only write to the Panel state if the job was not cancelled
+        // and the Panel has not been popped; the guard keeps the Panel
+        // from being reclaimed during the write
+        success = (result == FfxDeviceStatusOk);
+        if (success && !ffx_isJobCancelled(id)) {
+            if (panel_guard(job->panelId)) {
+                *job->attestOut = job->attest;
+            }
+            panel_unguard();
+        }
+    }
+
+    free(job);
+
+    return success;
+}
+
+int ffx_deviceAttestAsync(FfxDeviceAttestation *attestOut,
+  const FfxCborCursor *payload) {
+
+    if (status) { return 0; }
+
+    AttestJob *job = malloc(sizeof(AttestJob));
+    if (job == NULL) { return 0; }
+
+    job->panelId = panel_currentId();
+    job->attestOut = attestOut;
+
+    createNonce(job->nonce);
+
+    // The payload is hashed now, so it need not outlive this call
+    {
+        uint8_t scratch[64] = { 0 };
+        if (!hashAttest(scratch, payload)) {
+            free(job);
+            return 0;
+        }
+        memcpy(job->challenge, scratch, 32);
+    }
+
+    int id = ffx_runJob(attestJob, job);
+    if (id == 0) { free(job); }
+
+    return id;
 }
 
 bool ffx_hashAttest(uint8_t *digestOut, const FfxCborCursor *payload) {
@@ -450,13 +1056,12 @@ bool ffx_hashAttest(uint8_t *digestOut, const FfxCborCursor *payload) {
     return true;
 }
 
-static bool _device_testPrivkey(FfxEcPrivkey *privkey, uint32_t account) {
-    if (status || cipherdata == NULL || account > 0x7fffffff) { return false; }
+// Computes the m/44'/60' node of the device DEV mnemonic
+static bool _device_testNode(FfxHDNode *node, YieldState *yield) {
+    if (ensureLoaded() || cipherdata == NULL) { return false; }
 
     uint8_t digest[32];
-    ffx_hash_keccak256(digest, (uint8_t*)cipherdata, sizeof(esp_ds_data_t));
-    //taskYIELD();
-    delay(1);
+    memcpy(digest, cipherdigest, sizeof(digest));
 
     // Used for the various purpose:
     //   - nonce (16 bytes)
@@ -472,9 +1077,12 @@ static bool _device_testPrivkey(FfxEcPrivkey *privkey, uint32_t account) {
     tmp[0] |= 0x80;
 
     FfxDeviceAttestation attest = { 0 };
-    if (_device_attest(digest, tmp, &attest)) { return false; }
-    //taskYIELD();
-    delay(1);
+    if (_device_attest(ATTEST_VERSION, digest, tmp, &attest)) {
+        return false;
+    }
+
+    // The task slept while the DS peripheral worked
+    yieldInit(yield);
 
     // tmp = entropy
 
@@ -482,8 +1090,7 @@ static bool _device_testPrivkey(FfxEcPrivkey *privkey, uint32_t account) {
 
     FfxMnemonic mnemonic = { 0 };
     if (!ffx_mnemonic_initEntropy(&mnemonic, tmp, 16)) { return false; }
-    //taskYIELD();
-    delay(1);
+    yieldPoint(yield);
 
     static bool showMnemonic = false;
     if (showMnemonic) {
@@ -498,85 +1105,258 @@ static bool _device_testPrivkey(FfxEcPrivkey *privkey, uint32_t account) {
 
     // tmp = seed
 
-    if (!ffx_mnemonic_getSeed(&mnemonic, "", tmp)) { return false; }
-    //taskYIELD();
-    delay(1);
+    bool success = ffx_mnemonic_getSeed(&mnemonic, "", tmp);
+    memset(&mnemonic, 0, sizeof(mnemonic));
+    if (!success) { return false; }
+    yieldPoint(yield);
 
-    FfxHDNode node = { 0 };
-    if (!ffx_hdnode_initSeed(&node, tmp)) { return false; }
-    //taskYIELD();
-    delay(1);
+    success = ffx_hdnode_initSeed(node, tmp);
+    memset(tmp, 0, sizeof(tmp));
+    if (!success) { return false; }
+    yieldPoint(yield);
+
+    // Derive: m/44'/60'
+
+    if (!ffx_hdnode_deriveChild(node, 44 | FfxHDNodeHardened)) { return false; }
+    yieldPoint(yield);
+
+    if (!ffx_hdnode_deriveChild(node, 60 | FfxHDNodeHardened)) { return false; }
+
+    return true;
+}
+
+// Derives the ${ account }'/0/0 privkey from the m/44'/60' %%node%%
+static bool _device_testPrivkey(FfxEcPrivkey *privkey, const FfxHDNode *node,
+  uint32_t account, YieldState *yield) {
+
+    FfxHDNode child = *node;
+
+    bool success = false;
 
     // Derive: m/44'/60'/${ index }'/0/0
 
-    if (!ffx_hdnode_deriveChild(&node, 44 | FfxHDNodeHardened)) { return false; }
-    //taskYIELD();
-    delay(1);
+    if (!ffx_hdnode_deriveChild(&child, account | FfxHDNodeHardened)) {
+        goto done;
+    }
+    yieldPoint(yield);
 
-    if (!ffx_hdnode_deriveChild(&node, 60 | FfxHDNodeHardened)) { return false; }
-    //taskYIELD();
-    delay(1);
+    if (!ffx_hdnode_deriveChild(&child, 0)) { goto done; }
+    yieldPoint(yield);
 
-    if (!ffx_hdnode_deriveChild(&node, account | FfxHDNodeHardened)) { return false; }
-    //taskYIELD();
-    delay(1);
+    if (!ffx_hdnode_deriveChild(&child, 0)) { goto done; }
+    yieldPoint(yield);
 
-    if (!ffx_hdnode_deriveChild(&node, 0)) { return false; }
-    //taskYIELD();
-    delay(1);
+    success = ffx_hdnode_getPrivkey(&child, privkey);
 
-    if (!ffx_hdnode_deriveChild(&node, 0)) { return false; }
-    //taskYIELD();
-    delay(1);
+done:
+    memset(&child, 0, sizeof(child));
 
-    // tmp = privkey
+    return success;
+}
 
-    if (!ffx_hdnode_getPrivkey(&node, privkey)) { return false; }
+bool ffx_deviceTestPrivkey(FfxEcPrivkey *privkey, uint32_t account) {
+    if (account > 0x7fffffff) { return false; }
 
-    {
-        FfxEcPubkey pubkey = { 0 };
-        if(!ffx_ec_computePubkey(&pubkey, privkey)) { return false; }
+    xSemaphoreTake(testKeyLock, portMAX_DELAY);
 
-        FfxAddress addr = ffx_eth_getAddress(&pubkey);
-        FfxChecksumAddress address = ffx_eth_checksumAddress(&addr);
-        printf("Address (test account #0): %s\n", address.text);
+    if (account == 0 && privkey0Ready) {
+        *privkey = privkey0;
+        xSemaphoreGive(testKeyLock);
+        return true;
     }
 
-    memset(tmp, 0, sizeof(tmp));
+    // Derive from a copy, so other accounts (or a lock) are not blocked
+    // while the derivation runs
+    FfxHDNode node = testNode;
+    bool nodeReady = testNodeReady;
+    uint32_t epoch = testKeyEpoch;
+
+    xSemaphoreGive(testKeyLock);
+
+    if (!nodeReady) {
+        uint32_t t0 = ticks();
+
+        YieldState yield;
+        yieldInit(&yield);
+
+        // The PBKDF2 runs for over a second; compute outside the lock
+        // and publish the result (concurrent misses may both compute)
+        if (!_device_testNode(&node, &yield)) {
+            memset(&node, 0, sizeof(node));
+            return false;
+        }
+
+        FFX_LOG("computed test node: dt=%ldms longest-span=%lldus",
+          ticks() - t0, yield.longest);
+
+        xSemaphoreTake(testKeyLock, portMAX_DELAY);
+        if (!testNodeReady && epoch == testKeyEpoch) {
+            testNode = node;
+            testNodeReady = true;
+        }
+        xSemaphoreGive(testKeyLock);
+    }
+
+    uint32_t t0 = ticks();
+
+    YieldState yield;
+    yieldInit(&yield);
+
+    bool success = _device_testPrivkey(privkey, &node, account, &yield);
+    memset(&node, 0, sizeof(node));
+    if (!success) { return false; }
+
+    FFX_LOG("computed test account %ld: dt=%ldms longest-span=%lldus",
+      account, ticks() - t0, yield.longest);
+
+    if (account == 0) {
+        xSemaphoreTake(testKeyLock, portMAX_DELAY);
+
+        // Only keep it if there was no lock during the derivation
+        if (epoch == testKeyEpoch && !privkey0Ready) {
+            privkey0 = *privkey;
+            privkey0Ready = true;
+        }
+
+        xSemaphoreGive(testKeyLock);
+    }
+
+    // Persist the public data, so it is available without deriving
+    // the privkey again (even after a reboot)
+    if (!public_find(account, NULL, NULL)) {
+        FfxEcPubkey pubkey = { 0 };
+        if (ffx_ec_computePubkey(&pubkey, privkey)) {
+            FfxAddress address = ffx_eth_getAddress(&pubkey);
+            public_store(account, &pubkey, &address);
+        }
+    }
 
     return true;
 }
 
+static bool testPublic(uint32_t account, FfxEcPubkey *pubkey,
+  FfxAddress *address) {
 
-bool ffx_deviceTestPrivkey(FfxEcPrivkey *privkey, uint32_t account) {
+    if (ensureLoaded()) { return false; }
 
-    if (account == 0) {
-        static bool privkey0Ready = false;
-        static FfxEcPrivkey privkey0 = { 0 };
+    if (public_find(account, pubkey, address)) { return true; }
 
-        xSemaphoreTake(privkey0Lock, portMAX_DELAY);
+    // Not cached; derive it (which adds it to the cache)
+    FfxEcPrivkey privkey = { 0 };
+    bool success = ffx_deviceTestPrivkey(&privkey, account);
+    memset(&privkey, 0, sizeof(privkey));
+    if (!success) { return false; }
 
-        if (!privkey0Ready) {
-            int t0 = ticks();
+    return public_find(account, pubkey, address);
+}
 
-            bool status = _device_testPrivkey(&privkey0, account);
-            if (!status) {
-                xSemaphoreGive(privkey0Lock);
-                return false;
-            }
+bool ffx_deviceTestPubkey(FfxEcPubkey *pubkeyOut, uint32_t account) {
+    return testPublic(account, pubkeyOut, NULL);
+}
 
-            privkey0Ready = 1;
+bool ffx_deviceTestAddress(FfxAddress *addressOut, uint32_t account) {
+    return testPublic(account, NULL, addressOut);
+}
 
-            t0 = ticks() - t0;
-            printf("Computed Account 0: %d.%ds\n", t0 / 1000, t0 % 1000);
+void ffx_deviceLock() {
+    xSemaphoreTake(testKeyLock, portMAX_DELAY);
+    wipeTestKeys();
+    testKeyEpoch++;
+    xSemaphoreGive(testKeyLock);
+}
+
+void ffx_deviceBenchmarkHashAttest(size_t maxParams) {
+    // Enough for the largest payload: ~64 bytes per param
+    size_t length = 256 + 64 * maxParams;
+    uint8_t *data = malloc(length);
+    if (data == NULL) {
+        FFX_LOG("benchmark: failed to allocate payload");
+        return;
+    }
+
+    uint8_t salt[32] = { 0 };
+
+    for (size_t count = 1; count <= maxParams; count *= 2) {
+        FfxCborBuilder builder = ffx_cbor_build(data, length);
+        ffx_cbor_appendMap(&builder, 5);
+
+        ffx_cbor_appendString(&builder, "version");
+        ffx_cbor_appendNumber(&builder, 1);
+
+        ffx_cbor_appendString(&builder, "domain");
+        ffx_cbor_appendMap(&builder, 2);
+        ffx_cbor_appendString(&builder, "chainId");
+        ffx_cbor_appendData(&builder, salt, 1);
+        ffx_cbor_appendString(&builder, "contract");
+        ffx_cbor_appendData(&builder, salt, 20);
+
+        ffx_cbor_appendString(&builder, "action");
+        ffx_cbor_appendString(&builder, "benchmark");
+
+        ffx_cbor_appendString(&builder, "params");
+        ffx_cbor_appendArray(&builder, count);
+        for (int i = 0; i < count; i++) {
+            ffx_cbor_appendMap(&builder, 3);
+            ffx_cbor_appendString(&builder, "type");
+            ffx_cbor_appendString(&builder, (i & 1) ? "bytes": "uint256");
+            ffx_cbor_appendString(&builder, "name");
+            ffx_cbor_appendString(&builder, "param");
+            ffx_cbor_appendString(&builder, "value");
+            ffx_cbor_appendData(&builder, salt, 32);
         }
 
-        xSemaphoreGive(privkey0Lock);
+        ffx_cbor_appendString(&builder, "salt");
+        ffx_cbor_appendData(&builder, salt, 32);
 
-        *privkey = privkey0;
+        FfxCborCursor payload = ffx_cbor_walk(data,
+          ffx_cbor_getBuildLength(&builder));
 
-        return true;
+        uint8_t digest[32];
+
+        const int iterations = 16;
+        bool success = true;
+
+        int64_t t0 = esp_timer_get_time();
+        for (int i = 0; i < iterations; i++) {
+            success = ffx_hashAttest(digest, &payload) && success;
+        }
+        int64_t dt = (esp_timer_get_time() - t0) / iterations;
+
+        FFX_LOG("benchmark: params=%d length=%d success=%d hash=%lldus",
+          count, ffx_cbor_getBuildLength(&builder), success, dt);
+    }
+
+    free(data);
+}
+
+void ffx_deviceBenchmarkTestPrivkey(uint32_t count) {
+    FfxEcPrivkey privkey = { 0 };
+
+    for (uint32_t account = 0; account < count; account++) {
+
+        // Uncached; the full path from the DS signature
+        ffx_deviceLock();
+
+        uint32_t t0 = ticks();
+        bool success = ffx_deviceTestPrivkey(&privkey, account);
+        uint32_t cold = ticks() - t0;
+
+        // Cached m/44'/60' node; avoid the account 0 privkey cache so
+        // every account measures the same derivations
+        if (account == 0) {
+            xSemaphoreTake(testKeyLock, portMAX_DELAY);
+            memset(&privkey0, 0, sizeof(privkey0));
+            privkey0Ready = false;
+            xSemaphoreGive(testKeyLock);
+        }
+
+        t0 = ticks();
+        success = ffx_deviceTestPrivkey(&privkey, account) && success;
+        uint32_t warm = ticks() - t0;
+
+        FFX_LOG("benchmark: account=%ld success=%d uncached=%ldms cached=%ldms",
+          account, success, cold, warm);
     }
 
-    return _device_testPrivkey(privkey, account);
+    memset(&privkey, 0, sizeof(privkey));
 }
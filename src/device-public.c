@@ -0,0 +1,169 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "nvs_flash.h"
+
+#include "firefly-hollows.h"
+
+#include "device-public.h"
+#include "utils.h"
+
+
+// The NVS namespace (in the default partition) which holds the cache;
+// it only ever contains public data
+#define NVS_NAMESPACE         ("ffx-public")
+#define NVS_KEY               ("accounts")
+
+// Bump this if the layout of PublicCache changes; a mismatched blob is
+// discarded (and the data derived again)
+#define PUBLIC_VERSION        (1)
+
+
+typedef struct PublicEntry {
+    uint32_t account;
+    FfxEcPubkey pubkey;
+    FfxAddress address;
+} PublicEntry;
+
+typedef struct PublicCache {
+    uint32_t version;
+
+    // The keccak256 of the cipherdata the entries were derived from
+    uint8_t cipherdigest[32];
+
+    // Kept in the order added, so index 0 is the first to be evicted
+    size_t count;
+    PublicEntry entries[MAX_PUBLIC_ACCOUNTS];
+} PublicCache;
+
+static PublicCache cache = { 0 };
+
+static bool loaded = false;
+
+static StaticSemaphore_t lockBuffer;
+static SemaphoreHandle_t lock = NULL;
+
+
+static void save() {
+    nvs_handle_t nvs;
+    int ret = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret) {
+        FFX_LOG("failed to open public cache: ret=%d", ret);
+        return;
+    }
+
+    ret = nvs_set_blob(nvs, NVS_KEY, &cache, sizeof(cache));
+    if (ret == 0) { ret = nvs_commit(nvs); }
+    if (ret) { FFX_LOG("failed to save public cache: ret=%d", ret); }
+
+    nvs_close(nvs);
+}
+
+void public_load(const uint8_t *cipherdigest) {
+    if (lock == NULL) {
+        lock = xSemaphoreCreateBinaryStatic(&lockBuffer);
+        xSemaphoreGive(lock);
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    memset(&cache, 0, sizeof(cache));
+
+    nvs_handle_t nvs;
+    int ret = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (ret == 0) {
+        size_t olen = sizeof(cache);
+        ret = nvs_get_blob(nvs, NVS_KEY, &cache, &olen);
+        nvs_close(nvs);
+
+        if (ret || olen != sizeof(cache) || cache.version != PUBLIC_VERSION ||
+          cache.count > MAX_PUBLIC_ACCOUNTS ||
+          memcmp(cache.cipherdigest, cipherdigest, 32)) {
+
+            if (ret != ESP_ERR_NVS_NOT_FOUND) {
+                FFX_LOG("discarding public cache: ret=%d length=%d", ret,
+                  olen);
+            }
+
+            memset(&cache, 0, sizeof(cache));
+        }
+    }
+
+    cache.version = PUBLIC_VERSION;
+    memcpy(cache.cipherdigest, cipherdigest, 32);
+
+    loaded = true;
+
+    xSemaphoreGive(lock);
+}
+
+bool public_find(uint32_t account, FfxEcPubkey *pubkeyOut,
+  FfxAddress *addressOut) {
+
+    if (!loaded) { return false; }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    bool found = false;
+    for (int i = 0; i < cache.count; i++) {
+        PublicEntry *entry = &cache.entries[i];
+        if (entry->account != account) { continue; }
+
+        if (pubkeyOut) { *pubkeyOut = entry->pubkey; }
+        if (addressOut) { *addressOut = entry->address; }
+        found = true;
+        break;
+    }
+
+    xSemaphoreGive(lock);
+
+    return found;
+}
+
+void public_store(uint32_t account, const FfxEcPubkey *pubkey,
+  const FfxAddress *address) {
+
+    if (!loaded) { return; }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    for (int i = 0; i < cache.count; i++) {
+        if (cache.entries[i].account == account) {
+            xSemaphoreGive(lock);
+            return;
+        }
+    }
+
+    if (cache.count == MAX_PUBLIC_ACCOUNTS) {
+        memmove(&cache.entries[0], &cache.entries[1],
+          (MAX_PUBLIC_ACCOUNTS - 1) * sizeof(PublicEntry));
+        cache.count--;
+    }
+
+    PublicEntry *entry = &cache.entries[cache.count++];
+    entry->account = account;
+    entry->pubkey = *pubkey;
+    entry->address = *address;
+
+    save();
+
+    xSemaphoreGive(lock);
+}
+
+void public_dump() {
+    if (!loaded) { return; }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    FFX_LOG("public cache: accounts=%d", cache.count);
+
+    for (int i = 0; i < cache.count; i++) {
+        PublicEntry *entry = &cache.entries[i];
+        FfxChecksumAddress address = ffx_eth_checksumAddress(&entry->address);
+        FFX_LOG("  account %ld: %s", entry->account, address.text);
+    }
+
+    xSemaphoreGive(lock);
+}
@@ -0,0 +1,51 @@
+#ifndef __DEVICE_PUBLIC_H__
+#define __DEVICE_PUBLIC_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "firefly-ecc.h"
+#include "firefly-eth.h"
+
+
+// The number of test accounts whose public data is cached
+#define MAX_PUBLIC_ACCOUNTS     (8)
+
+
+/**
+ *  Load the cached public data from NVS, discarding it if it was derived
+ *  from a different %%cipherdigest%% (the keccak256 of the device DS
+ *  cipherdata). The default NVS partition must already be initialized.
+ */
+void public_load(const uint8_t *cipherdigest);
+
+/**
+ *  Populate %%pubkeyOut%% and %%addressOut%% (either may be NULL) with
+ *  the cached public data for %%account%%, returning false if it is not
+ *  cached.
+ */
+bool public_find(uint32_t account, FfxEcPubkey *pubkeyOut,
+  FfxAddress *addressOut);
+
+/**
+ *  Add the public data for %%account%% to the cache and persist it,
+ *  evicting the least-recently added account if full.
+ */
+void public_store(uint32_t account, const FfxEcPubkey *pubkey,
+  const FfxAddress *address);
+
+/**
+ *  Dump the cached public data to the console.
+ */
+void public_dump();
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __DEVICE_PUBLIC_H__ */
@@ -1,14 +1,20 @@
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
 #include "freertos/task.h"
 
+#include "esp_timer.h"
+#include "nvs_flash.h"
+
 #include "hollows.h"
 #include "utils.h"
 
 
-#define PRIORITY_PRIME    (2)
+// Above only the idle task, so warm-ups run when the CPU would idle
+#define PRIORITY_PRIME    (1)
 #define PRIORITY_APP      (3)
 #define PRIORITY_BLE      (5)
 #define PRIORITY_IO       (6)
@@ -20,7 +26,62 @@ __attribute__((used)) const char code_signature[] =
 
 
 
+///////////////////////////////
+// Boot timeline
+
+typedef struct BootTime {
+    int64_t start;
+    int64_t end;
+} BootTime;
+
+static const char* const bootPhaseNames[] = {
+    "device", "device-load", "io", "ble", "app", "first-frame", "advertise"
+};
+
+static BootTime bootTimeline[BootPhaseCount] = { 0 };
+
+// A bit is set for each phase once it has ended, which tasks that
+// depend on it wait for
+static StaticEventGroup_t bootEventsBuffer;
+static EventGroupHandle_t bootEvents = NULL;
+
+#define BOOT_BIT(phase)     (1 << (phase))
+
+void boot_begin(BootPhase phase) {
+    bootTimeline[phase].start = esp_timer_get_time();
+}
+
+void boot_end(BootPhase phase) {
+    if (bootTimeline[phase].end) { return; }
+    bootTimeline[phase].end = esp_timer_get_time();
+
+    if (bootEvents) { xEventGroupSetBits(bootEvents, BOOT_BIT(phase)); }
+}
+
+static void waitForPhases(EventBits_t phases) {
+    xEventGroupWaitBits(bootEvents, phases, pdFALSE, pdTRUE, portMAX_DELAY);
+}
+
+static void dumpBootTimeline() {
+    FFX_LOG("boot timeline (ms since start):");
+    for (int i = 0; i < BootPhaseCount; i++) {
+        BootTime *time = &bootTimeline[i];
+        if (time->start == 0) {
+            FFX_LOG("  %-12s  pending", bootPhaseNames[i]);
+        } else if (time->end == 0) {
+            FFX_LOG("  %-12s  start=%lld  running", bootPhaseNames[i],
+              time->start / 1000);
+        } else {
+            FFX_LOG("  %-12s  start=%lld  end=%lld  dt=%lld",
+              bootPhaseNames[i], time->start / 1000, time->end / 1000,
+              (time->end - time->start) / 1000);
+        }
+    }
+}
+
+
 static TaskHandle_t taskAppHandle = NULL;
+static TaskHandle_t taskPrimeHandle = NULL;
 static TaskHandle_t taskBleHandle = NULL;
 static TaskHandle_t taskIoHandle = NULL;
 
@@ -47,35 +108,26 @@ void taskAppFunc(void* pvParameter) {
     while (1) { delay(10000); }
 }
 
-void taskPrimeFunc(void* pvParameter) {
-    vTaskSetApplicationTaskTag(NULL, (void*) NULL);
+// Warm-ups registered by the Springboard
 
-    {
-        FfxEcPrivkey privkey0;
-        ffx_deviceTestPrivkey(&privkey0, 0);
-    }
+static void warmupDeviceLoad(void *arg) {
+    // Load the provisioning data in the background, so the first
+    // attestation doesn't have to
+    if (ffx_deviceStatus()) { return; }
+
+    char modelName[32] = { 0 };
+    ffx_deviceModelName(modelName, sizeof(modelName) - 1);
+    FFX_LOG("device: serial=%d model=0x%x modelName='%s'",
+      ffx_deviceSerialNumber(), ffx_deviceModelNumber(), modelName);
+}
 
-    FFX_LOG("PRIME task done; high-water: %u", uxTaskGetStackHighWaterMark(NULL));
-/*
-    uint8_t challenge[32] = { 0 };
-    challenge[31] = 42;
-    challenge[30] = 41;
-    challenge[29] = 40;
-
-    DeviceAttestation attest = { 0 };
-    DeviceStatus status = device_attest(challenge, &attest);
-
-    printf("ATTEST: v=%d model=%d, serial=%d\n", attest.version,
-      (int)attest.modelNumber, (int)attest.serialNumber);
-    dumpBuffer("  nonce:      ", attest.nonce, sizeof(attest.nonce));
-    dumpBuffer("  challenge:  ", attest.challenge, sizeof(attest.challenge));
-    dumpBuffer("  pukbkeyN:    ", attest.pubkeyN, sizeof(attest.pubkeyN));
-    dumpBuffer("  attestProof: ", attest.attestProof,
-      sizeof(attest.attestProof));
-    dumpBuffer("  signature:   ", attest.signature, sizeof(attest.signature));
-*/
-    // Farewell...
-    vTaskDelete(NULL);
+static void warmupTestAddress(void *arg) {
+    // Instant once cached; otherwise this derives (and caches) it
+    FfxAddress addr;
+    if (!ffx_deviceTestAddress(&addr, 0)) { return; }
+
+    FfxChecksumAddress address = ffx_eth_checksumAddress(&addr);
+    printf("Address (test account #0): %s\n", address.text);
 }
 
 
@@ -84,61 +136,97 @@ void ffx_init(uint32_t version, FfxBackgroundFunc backgroundFunc, FfxInitFunc in
 
     vTaskSetApplicationTaskTag(NULL, (void*)NULL);
 
-    // Load NVS and eFuse provision data
+    bootEvents = xEventGroupCreateStatic(&bootEventsBuffer);
+
+    // Initialize NVS before any task may use it; the BLE stack (PHY
+    // calibration and bonds), the public cache and the lazy load of the
+    // provisioning data (from whichever task first needs it) all do
+    {
+        esp_err_t status = nvs_flash_init();
+        if (status == ESP_ERR_NVS_NO_FREE_PAGES || status == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+            ESP_ERROR_CHECK(nvs_flash_erase());
+            status = nvs_flash_init();
+        }
+        ESP_ERROR_CHECK(status);
+    }
+
+    // Warm-ups and jobs may be added from here on (including by the app)
+    prime_init();
+    jobs_init();
+    timers_init();
+
+    // Load eFuse provision data (the NVS data is loaded lazily)
     {
         uint32_t t0 = ticks();
 
+        boot_begin(BootPhaseDevice);
         FfxDeviceStatus status = ffx_deviceInit();
+        boot_end(BootPhaseDevice);
+
+        // The serial and model are logged once the provisioning data
+        // has loaded (see warmupDeviceLoad)
         if (status == FfxDeviceStatusOk) {
-            char modelName[32] = { 0 };
-            ffx_deviceModelName(modelName, sizeof(modelName) - 1);
-            FFX_LOG("device: serial=%d model=0x%x modelName='%s' (dt=%ld)",
-              ffx_deviceSerialNumber(), ffx_deviceModelNumber(), modelName,
-              ticks() - t0);
+            FFX_LOG("device: eFuse ok (dt=%ld)", ticks() - t0);
         } else {
             FFX_LOG("device: status=%d (unprovisioned)", status);
         }
     }
 
+    // Boot dependencies; each task is started (or continues) once the
+    // phases it depends on have ended:
+    //   - io, ble:  device
+    //   - app:      io (the canvas), ble (the message queues)
+    //   - prime:    app
+    //
+    // The IO and BLE tasks are independent, so they are brought up
+    // concurrently and the radio can advertise while the display is
+    // still initializing.
+
     // Start the IO task (handles the display, LEDs and keypad) [priority: 6]
-    {
-        uint32_t t0 = ticks();
+    StaticSemaphore_t ioReadyBuffer;
 
-        // Pointer passed to taskIoFunc to notify us when IO is ready
-        StaticSemaphore_t readyBuffer;
+    TaskIoInit ioInit = {
+        .backgroundFunc = backgroundFunc,
+        .arg = arg,
+        .ready = xSemaphoreCreateBinaryStatic(&ioReadyBuffer)
+    };
 
-        TaskIoInit init = {
-            .backgroundFunc = backgroundFunc,
-            .arg = arg,
-            .ready = xSemaphoreCreateBinaryStatic(&readyBuffer)
-        };
+    {
+        boot_begin(BootPhaseIo);
+        boot_begin(BootPhaseFirstFrame);
 
         BaseType_t status = xTaskCreatePinnedToCore(&taskIoFunc, "io",
-          14 * 256, &init, PRIORITY_IO, &taskIoHandle, 0);
+          14 * 256, &ioInit, PRIORITY_IO, &taskIoHandle, 0);
         assert(status && taskIoHandle != NULL);
-
-        // Wait for the IO task to complete setup
-        xSemaphoreTake(init.ready, portMAX_DELAY);
-
-        FFX_LOG("IO task ready (dt=%ld)", ticks() - t0);
     }
 
     // Start the Message task (handles BLE messages) [priority: 5]
-    {
-        // Pointer passed to taskIoFunc to notify us when IO is ready
-        StaticSemaphore_t readyBuffer;
+    StaticSemaphore_t bleReadyBuffer;
 
-        TaskBleInit init = {
-          .version = version
-            .ready = xSemaphoreCreateBinaryStatic(&readyBuffer)
-        };
+    TaskBleInit bleInit = {
+        .version = version,
+        .ready = xSemaphoreCreateBinaryStatic(&bleReadyBuffer)
+    };
+
+    {
+        boot_begin(BootPhaseBle);
+        boot_begin(BootPhaseAdvertise);
 
         BaseType_t status = xTaskCreatePinnedToCore(&taskBleFunc, "ble",
-          14 * 256, &init, PRIORITY_BLE, &taskBleHandle, 0);
+          14 * 256, &bleInit, PRIORITY_BLE, &taskBleHandle, 0);
         assert(status && taskBleHandle != NULL);
+    }
 
-        // Wait for the IO task to complete setup
-        xSemaphoreTake(init.ready, portMAX_DELAY);
+    // Wait for the IO and BLE tasks to complete setup (the init values
+    // live on this stack)
+    {
+        uint32_t t0 = ticks();
+
+        xSemaphoreTake(bleInit.ready, portMAX_DELAY);
+        xSemaphoreTake(ioInit.ready, portMAX_DELAY);
+        waitForPhases(BOOT_BIT(BootPhaseIo) | BOOT_BIT(BootPhaseBle));
+
+        FFX_LOG("IO and BLE tasks ready (dt=%ld)", ticks() - t0);
     }
 
     // Start app process [priority: 3];
@@ -154,39 +242,53 @@ void ffx_init(uint32_t version, FfxBackgroundFunc backgroundFunc, FfxInitFunc in
             .ready = xSemaphoreCreateBinaryStatic(&readyBuffer)
         };
 
+        boot_begin(BootPhaseApp);
+
+        // Every Panel runs nested on this task, so it must have room for
+        // the deepest Panel Stack: MIN_PUSH_HEADROOM (7KB) for the top
+        // Panel's handlers, plus about 768 bytes for each of the
+        // MAX_PANEL_DEPTH (8) nested loops and their calling handlers,
+        // plus the root. Pushes past either limit are refused (see
+        // panel.c); the deepest nesting and least headroom seen are
+        // reported by ffx_dumpStats.
         BaseType_t status = xTaskCreatePinnedToCore(&taskAppFunc, "app",
-          12 * 256, &init, PRIORITY_APP, &taskAppHandle, 0);
+          56 * 256, &init, PRIORITY_APP, &taskAppHandle, 0);
         assert(status && taskAppHandle != NULL);
 
         // Wait for the IO task to complete setup
         xSemaphoreTake(init.ready, portMAX_DELAY);
 
+        boot_end(BootPhaseApp);
+
         FFX_LOG("APP task ready (dt=%ld)", ticks() - t0);
     }
 
-    // Start prime process [priority: 2];
+    // Start the prime process, which runs warm-up jobs [priority: 1];
     {
-        TaskHandle_t taskPrimeHandle = NULL;
-
-        // Pointer passed to taskAppFunc to notify us when APP is ready
-        //uint32_t ready = 0;
+        ffx_addWarmup("device-load", warmupDeviceLoad, NULL);
+        ffx_addWarmup("test-address", warmupTestAddress, NULL);
 
         BaseType_t status = xTaskCreatePinnedToCore(&taskPrimeFunc, "prime",
           32 * 256, NULL, PRIORITY_PRIME, &taskPrimeHandle, 0);
         assert(status && taskPrimeHandle != NULL);
-
-        // Wait for the prime task to complete setup
-        //while (!ready) { delay(1); }
-        //FFX_LOG("PRIME task done");
     }
 }
 
 void ffx_dumpStats() {
-    FFX_LOG("ticks=%ld; heap=%ld; high-water: main=%u io=%u, ble=%u app=%u, freq=%ld",
+    FFX_LOG("ticks=%ld; heap=%ld; high-water: main=%u io=%u, ble=%u app=%u prime=%u jobs=%d, freq=%ld",
       ticks(), esp_get_free_heap_size(),
       uxTaskGetStackHighWaterMark(NULL),
       uxTaskGetStackHighWaterMark(taskIoHandle),
       uxTaskGetStackHighWaterMark(taskBleHandle),
       uxTaskGetStackHighWaterMark(taskAppHandle),
+      uxTaskGetStackHighWaterMark(taskPrimeHandle),
+      jobs_stackHighWater(),
       portTICK_PERIOD_MS);
+
+    dumpBootTimeline();
+
+    ffx_bleDumpStats();
+    ffx_deviceDumpStats();
+    prime_dumpStats();
+    panel_dumpStats();
 }
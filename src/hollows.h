@@ -18,11 +18,78 @@ typedef enum PanelStyle {
     PanelStyleSlideLeft,
 } PanelStyle;
 
+///////////////////////////////
+// hollows.c
+
+typedef enum BootPhase {
+    // eFuse and ECC (ffx_deviceInit)
+    BootPhaseDevice = 0,
+
+    // NVS provisioning data (loaded lazily)
+    BootPhaseDeviceLoad,
+
+    // Task bring-up (until each signals it is ready)
+    BootPhaseIo,
+    BootPhaseBle,
+    BootPhaseApp,
+
+    // Milestones; from the task creation until the first frame has been
+    // rendered and until the radio first advertises
+    BootPhaseFirstFrame,
+    BootPhaseAdvertise,
+
+    BootPhaseCount
+} BootPhase;
+
+// Record the start and end of a boot phase for the boot timeline. Only
+// the first end is recorded, so these may be called from paths which
+// repeat (e.g. each frame).
+void boot_begin(BootPhase phase);
+void boot_end(BootPhase phase);
+
+
 ///////////////////////////////
 // device-info.c
 
 FfxDeviceStatus ffx_deviceInit();
 
+// Load the NVS provisioning data, if not already loaded; otherwise this
+// happens on first use
+void ffx_deviceLoad();
+
+// Dump the device (attestation) counters to the console
+void ffx_deviceDumpStats();
+
+
+///////////////////////////////
+// panel.c
+
+// Returns the id of the Panel running on the calling task (0 if none)
+int panel_currentId();
+
+// Returns true if the Panel %%panelId%% is still on the Panel Stack
+bool panel_isAlive(int panelId);
+
+// Holds off reclaiming any popped Panel until [[panel_unguard]], so
+// another task may safely write into the state of %%panelId%% if this
+// returns true (it is on the stack and not closing). Must always be
+// paired with panel_unguard, and the caller must not block in between.
+bool panel_guard(int panelId);
+void panel_unguard();
+
+// Queues %%event%% for the Panel %%panelId%% (whether or not it is the
+// Active Panel) returning true if it is on the stack with a handler
+// and the event was queued
+bool panel_emitEvent(int panelId, FfxEvent event, FfxEventProps props);
+
+// Dump the Panel pool, push/pop latency and heap fragmentation
+void panel_dumpStats();
+
+// Free a popped Panel scene tree if there is time before
+// %%frameDeadline%% (in us), and record the frame time since
+// %%frameStart%%; called by the IO task once per frame
+void panel_reclaim(int64_t frameStart, int64_t frameDeadline);
+
 
 ///////////////////////////////
 // task-io.c
@@ -48,6 +115,49 @@ typedef struct TaskBleInit {
 
 void taskBleFunc(void* pvParameter);
 
+// Dump the BLE link and protocol counters to the console
+void ffx_bleDumpStats();
+
+
+///////////////////////////////
+// task-jobs.c
+
+// Must be called before any job is run
+void jobs_init();
+
+// Discard any speculative jobs for %%messageId%%, which has been replied
+// to or abandoned; safe to call with 0
+void jobs_discardMessage(int messageId);
+
+// The least stack (in bytes) the worker has had free, or -1 if it has
+// not been started
+int jobs_stackHighWater();
+
+
+///////////////////////////////
+// timers.c
+
+// Must be called before any timer is set
+void timers_init();
+
+// Fire any expired timers; called by the IO task once per frame
+void timers_tick(uint32_t now);
+
+// Clear all timers owned by %%panelId%%
+void timers_cancelPanel(int panelId);
+
+
+///////////////////////////////
+// task-prime.c
+
+// Must be called before any warm-up is added
+void prime_init();
+
+void taskPrimeFunc(void* pvParameter);
+
+// Dump the warm-up jobs and their durations to the console
+void prime_dumpStats();
+
 
 
 
@@ -1,9 +1,15 @@
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
 #include "hollows.h"
 #include "utils.h"
 
@@ -14,86 +20,574 @@ extern FfxScene scene;
 
 #define MAX_EVENT_BACKLOG  (16)
 
+// The backlog for events which must never be dropped; these are also
+// dispatched ahead of the normal backlog
+#define MAX_PRIORITY_BACKLOG  (8)
+
+// The events which may be in flight from other tasks before the event
+// loop moves them into the lanes; must be a power of 2
+#define MAX_RING_BACKLOG   (32)
+
+// The ring slots only never-drop events may use, so droppable events
+// backing up during a long handler cannot starve keys and messages
+#define RING_RESERVE       (8)
+
+// The Panel state size classes (in bytes) and the number of blocks of
+// each retained for reuse; larger states always use the heap
+#define POOL_CLASS_COUNT   (3)
+static const size_t poolClassSize[POOL_CLASS_COUNT] = { 256, 1024, 4096 };
+static const int poolClassLimit[POOL_CLASS_COUNT] = { 4, 2, 1 };
+
+// The most heap (in bytes) idle blocks may hold in total. Each block
+// also carries its event ring and lanes, so the class limits alone
+// would retain several times the state sizes; blocks released beyond
+// this are freed
+#define POOL_RETAIN_MAX    (8 * 1024)
+
+// The most Panels pushed with ffx_pushPanel nested within each other;
+// each nests an event loop (and its handlers) on the app task stack
+#define MAX_PANEL_DEPTH    (8)
+
+// The app task stack (in bytes) which must remain free to push a Panel,
+// for its init and the nested event loop and handlers; the largest
+// handlers (synchronous attestation and test key derivation, with their
+// 384-byte buffers and PBKDF2 state) needed the 8KB prime task stack
+#define MIN_PUSH_HEADROOM  (7 * 1024)
+
+// The popped scene trees awaiting teardown; if full, a tree is removed
+// immediately
+#define MAX_RECLAIM        (8)
+
+// Time (in us) left unused at the end of each frame for jitter
+#define RECLAIM_MARGIN     (2000)
+
+// The number of frames after a pop to watch for the worst frame time
+#define RECLAIM_WATCH      (30)
+
+
+typedef struct EventDispatch {
+    FfxEvent event;
+    FfxEventFunc callback;
+    void* arg;
+    FfxEventProps props;
+
+    // Queued on the priority lane (and so may not be evicted)
+    bool priority;
+} EventDispatch;
+
+// A ring of pending events; only touched by the event loop
+typedef struct EventLane {
+    EventDispatch *entries;
+    size_t capacity;
+    size_t head;
+    size_t count;
+} EventLane;
 
-typedef enum PanelFlags {
-    PanelFlagsHasRender    = (1 << 0)
-} PanelFlags;
+typedef enum Lane {
+    LanePriority = 0,
+    LaneNormal,
+    _LaneCount
+} Lane;
+
+typedef struct RingSlot {
+    // Equal to the position + 1 once published by a producer
+    atomic_uint sequence;
+
+    FfxEvent event;
+    FfxEventProps props;
+} RingSlot;
+
+// A bounded multi-producer, single-consumer ring; any task may emit
+// and only the Panel's event loop consumes. On the ESP32-C3 (no atomic
+// extension) each read-modify-write is a libatomic call which briefly
+// masks interrupts, so an emit costs a few short critical sections
+// rather than none.
+typedef struct EventRing {
+    RingSlot slots[MAX_RING_BACKLOG];
+    atomic_uint tail;
+
+    // Only advanced by the consumer; producers read it for the reserve
+    atomic_uint head;
+} EventRing;
 
 /**
- *  The struct storing a Panels state. This is stored on the stack of
- *  the Panel and is reclaimed when the task exists. It should not have
- *  any references maintained to it as it could vanish at any time.
+ *  The struct storing a Panels state. All Panels share the app task;
+ *  each [[ffx_pushPanel]] runs the child event loop nested on the
+ *  caller's stack, while [[ffx_pushPanelAsync]] children are dispatched
+ *  by the loop already running. This is stored in the Panel's pooled
+ *  block and is reclaimed once popped. It should not have any
+ *  references maintained to it as it could vanish at any time.
  */
 typedef struct PanelContext {
-    QueueHandle_t eventQueue;
+    EventRing *ring;
+    EventLane lanes[_LaneCount];
+    struct PanelBlock *block;
+
+    // Set by ffx_popPanel before it is unpublished; emitters must not
+    // queue events for a Panel being torn down
+    atomic_bool closing;
 
-    SemaphoreHandle_t done;
-    uint32_t *result;
+    // Set by ffx_popPanel; the event loop exits once the current
+    // handler returns
+    bool popped;
+    int result;
 
     FfxEventFunc events[_FfxEventCount];
     void* eventsArg[_FfxEventCount];
 
-    uint32_t flags;
+    // Events also delivered while covered by a child (1 << FfxEvent)
+    atomic_uint subscriptions;
+
+    // The latest render, coalesced before the ring so the frames during
+    // a long handler cannot fill it; the elapsed time accumulates until
+    // the event loop takes it
+    atomic_bool renderPending;
+    atomic_uint renderTicks;
+    atomic_uint renderDt;
 
     int id;
     struct PanelContext *parent;
 
+    // Pushed with ffx_pushPanelAsync; the parent is not blocked, so it
+    // keeps receiving its targeted (timer and job) and subscribed events
+    // while this Panel is active
+    bool async;
+
     FfxNode node;
     PanelStyle style;
 
     uint8_t *state;
+
+    // When ffx_popPanel was called (in us), for the pop latency
+    int64_t popStart;
 } PanelContext;
 
 
-PanelContext *active = NULL;
+// Published atomically, since any task may emit to the Active Panel
+static PanelContext * _Atomic active = NULL;
+
+// The number of emitters between reading the Panel Stack and finishing
+// their enqueue; a popped Panel is not reclaimed until this is 0
+static atomic_int emitters = 0;
 
 
 ///////////////////////////////
 // Events API
 
-typedef struct EventDispatch {
-    FfxEvent event;
-    FfxEventFunc callback;
-    void* arg;
-    FfxEventProps props;
-} EventDispatch;
+typedef enum EventPolicy {
+    // Appended to the normal lane; dropped if it is full
+    EventPolicyQueue = 0,
+
+    // Replaces any pending event of the same type (a state snapshot)
+    EventPolicyLatest,
+
+    // Appended to the priority lane; when full, spills into the normal
+    // lane evicting the oldest droppable event
+    EventPolicyNeverDrop,
+
+    // Progress is latest-wins for each job; completion is never dropped
+    // and removes any progress still pending for the job
+    EventPolicyJob
+} EventPolicy;
+
+// Keys are never merged; handlers match exact transitions (e.g. a single
+// key released), which a merged bitmask would break
+static const EventPolicy eventPolicies[_FfxEventCount] = {
+    [FfxEventRenderScene] = EventPolicyLatest,
+    [FfxEventRadioState] = EventPolicyLatest,
+    [FfxEventKeys] = EventPolicyNeverDrop,
+    [FfxEventFocus] = EventPolicyNeverDrop,
+    [FfxEventMessage] = EventPolicyNeverDrop,
+    [FfxEventJob] = EventPolicyJob,
+    [FfxEventTimer] = EventPolicyLatest,
+};
+
+// Given to wake the running event loop when it is sleeping; all Panels
+// share the app task, so only the innermost loop is ever waiting
+static StaticSemaphore_t wakeBuffer;
+static SemaphoreHandle_t wake = NULL;
+static atomic_bool sleeping = false;
+
+// Only updated by the event loop
+static uint32_t eventsCoalesced = 0;
+static uint32_t eventsSpilled = 0;
+static uint32_t eventsDropped = 0;
+
+static atomic_uint eventsRingFull = 0;
+
+// The events a Panel may receive while it is not the Active Panel; the
+// rest only make sense to the Panel on screen (or are targeted)
+static const uint32_t subscribableEvents = (1 << FfxEventRadioState) |
+  (1 << FfxEventUser1) | (1 << FfxEventUser2);
+
+static void ringInit(EventRing *ring) {
+    for (unsigned int i = 0; i < MAX_RING_BACKLOG; i++) {
+        atomic_init(&ring->slots[i].sequence, i);
+    }
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->head, 0);
+}
 
+// Any task; claims a slot by advancing the tail, then publishes it. The
+// last %%reserve%% slots are left free for other events.
+static bool ringPush(EventRing *ring, FfxEvent event, FfxEventProps props,
+  unsigned int reserve) {
 
-bool ffx_emitEvent(FfxEvent event, FfxEventProps props) {
-    if (active == NULL || event >= _FfxEventCount) { return false; }
+    unsigned int pos = atomic_load_explicit(&ring->tail,
+      memory_order_relaxed);
 
-    if (active->events[event] == NULL) { return false; }
-
-    if (event == FfxEventRenderScene) {
-        if (active->flags & PanelFlagsHasRender) {
-            FFX_LOG("already has render");
-            return true;
+    RingSlot *slot = NULL;
+    while (1) {
+        // The head only advances, so this may only overestimate the used
+        unsigned int head = atomic_load_explicit(&ring->head,
+          memory_order_relaxed);
+        if (pos - head >= MAX_RING_BACKLOG - reserve) { return false; }
+
+        slot = &ring->slots[pos & (MAX_RING_BACKLOG - 1)];
+        unsigned int seq = atomic_load_explicit(&slot->sequence,
+          memory_order_acquire);
+        int diff = (int)(seq - pos);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &pos,
+              pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Full
+            return false;
         } else {
-            active->flags |= PanelFlagsHasRender;
+            pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
         }
     }
 
+    slot->event = event;
+    slot->props = props;
+    atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+
+    return true;
+}
+
+// The event loop only
+static bool ringPop(EventRing *ring, FfxEvent *event, FfxEventProps *props) {
+    unsigned int head = atomic_load_explicit(&ring->head,
+      memory_order_relaxed);
+
+    RingSlot *slot = &ring->slots[head & (MAX_RING_BACKLOG - 1)];
+    unsigned int seq = atomic_load_explicit(&slot->sequence,
+      memory_order_acquire);
+    if (seq != head + 1) { return false; }
+
+    *event = slot->event;
+    *props = slot->props;
+    atomic_store_explicit(&slot->sequence, head + MAX_RING_BACKLOG,
+      memory_order_release);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_relaxed);
+
+    return true;
+}
+
+static EventDispatch* laneAt(EventLane *lane, size_t index) {
+    return &lane->entries[(lane->head + index) % lane->capacity];
+}
+
+static bool lanePush(EventLane *lane, const EventDispatch *dispatch) {
+    if (lane->count == lane->capacity) { return false; }
+    *laneAt(lane, lane->count++) = *dispatch;
+    return true;
+}
+
+static bool lanePop(EventLane *lane, EventDispatch *dispatch) {
+    if (lane->count == 0) { return false; }
+    *dispatch = lane->entries[lane->head];
+    lane->head = (lane->head + 1) % lane->capacity;
+    lane->count--;
+    return true;
+}
+
+static void laneRemove(EventLane *lane, size_t index) {
+    for (size_t i = index; i + 1 < lane->count; i++) {
+        *laneAt(lane, i) = *laneAt(lane, i + 1);
+    }
+    lane->count--;
+}
+
+// Replaces a pending event which %%dispatch%% supersedes, returning true
+// if found
+static bool coalesce(EventLane *lane, const EventDispatch *dispatch) {
+    for (size_t i = 0; i < lane->count; i++) {
+        EventDispatch *pending = laneAt(lane, i);
+        if (pending->event != dispatch->event) { continue; }
+
+        if (dispatch->event == FfxEventJob) {
+            if (pending->props.job.id != dispatch->props.job.id ||
+              pending->props.job.status != FfxJobStatusProgress) {
+                continue;
+            }
+        }
+
+        if (dispatch->event == FfxEventTimer &&
+          pending->props.timer.id != dispatch->props.timer.id) {
+            continue;
+        }
+
+        // Each radio has its own state
+        if (dispatch->event == FfxEventRadioState &&
+          pending->props.radio.id != dispatch->props.radio.id) {
+            continue;
+        }
+
+        // Keep the elapsed time across the frames coalesced
+        uint32_t dt = pending->props.render.dt;
+
+        pending->props = dispatch->props;
+        pending->callback = dispatch->callback;
+        pending->arg = dispatch->arg;
+
+        if (dispatch->event == FfxEventRenderScene) {
+            pending->props.render.dt += dt;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+// Removes any pending progress for the job %%jobId%%, which would
+// otherwise be dispatched after its completion (in the priority lane)
+static void dropProgress(EventLane *lane, int jobId) {
+    for (size_t i = 0; i < lane->count;) {
+        EventDispatch *pending = laneAt(lane, i);
+        if (pending->event == FfxEventJob && pending->props.job.id == jobId &&
+          pending->props.job.status == FfxJobStatusProgress) {
+            laneRemove(lane, i);
+            eventsCoalesced++;
+            continue;
+        }
+        i++;
+    }
+}
+
+// Queue a never-drop event, making room in the normal lane if the
+// priority lane is full
+static bool queuePriority(PanelContext *panel, const EventDispatch *dispatch) {
+    if (lanePush(&panel->lanes[LanePriority], dispatch)) { return true; }
+
+    EventLane *lane = &panel->lanes[LaneNormal];
+    if (lane->count == lane->capacity) {
+        for (size_t i = 0; i < lane->count; i++) {
+            if (laneAt(lane, i)->priority) { continue; }
+            laneRemove(lane, i);
+            eventsDropped++;
+            break;
+        }
+    }
+
+    eventsSpilled++;
+
+    return lanePush(lane, dispatch);
+}
+
+// The policy for %%event%%, with jobs resolved by their status
+static EventPolicy eventPolicy(FfxEvent event, const FfxEventProps *props) {
+    EventPolicy policy = eventPolicies[event];
+    if (policy == EventPolicyJob) {
+        policy = (props->job.status == FfxJobStatusProgress) ?
+          EventPolicyLatest: EventPolicyNeverDrop;
+    }
+    return policy;
+}
+
+// The event loop only; move an event from the ring into the lanes,
+// applying the coalescing policy
+static void laneEvent(PanelContext *panel, FfxEvent event,
+  FfxEventProps props) {
+
+    // The handler was removed since the event was emitted
+    if (panel->events[event] == NULL) { return; }
+
+    EventPolicy policy = eventPolicy(event, &props);
+
     EventDispatch dispatch = {
-        .callback = active->events[event],
-        .arg = active->eventsArg[event],
+        .callback = panel->events[event],
+        .arg = panel->eventsArg[event],
         .event = event,
         .props = props,
+        .priority = (policy == EventPolicyNeverDrop),
     };
 
-    BaseType_t status = xQueueSendToBack(active->eventQueue, &dispatch, 0);
-    if (status != pdTRUE) {
+    EventLane *lane = &panel->lanes[LaneNormal];
+    if (policy == EventPolicyLatest && coalesce(lane, &dispatch)) {
+        eventsCoalesced++;
+        return;
+    }
+
+    // Completion supersedes progress, so progress is never seen after it
+    if (event == FfxEventJob && props.job.status != FfxJobStatusProgress) {
+        dropProgress(lane, props.job.id);
+    }
+
+    bool queued = false;
+    if (policy == EventPolicyNeverDrop) {
+        queued = queuePriority(panel, &dispatch);
+    } else {
+        queued = lanePush(lane, &dispatch);
+    }
+
+    if (!queued) {
+        eventsDropped++;
         FFX_LOG("FAILED TO QUEUE EVENT: %02x", event);
-        // @TODO: panic?
+    }
+}
+
+// Returns true if %%panel%% is dispatched by the running loop; the
+// Active Panel and the Panels beneath it through async links (see
+// dispatchNext). The caller must be counted in emitters.
+static bool isRunning(PanelContext *panel) {
+    PanelContext *running = atomic_load(&active);
+    for (; running; running = running->parent) {
+        if (running == panel) { return true; }
+        if (!running->async) { break; }
+    }
+    return false;
+}
+
+// Any task; the caller must be counted in emitters
+static bool queueEvent(PanelContext *panel, FfxEvent event,
+  FfxEventProps props) {
+
+    if (panel->events[event] == NULL) { return false; }
+
+    // Being torn down; the event could never be dispatched
+    if (atomic_load(&panel->closing)) { return false; }
+
+    if (event == FfxEventRenderScene) {
+        atomic_fetch_add(&panel->renderDt, props.render.dt);
+        atomic_store(&panel->renderTicks, props.render.ticks);
+        atomic_store(&panel->renderPending, true);
+
+    } else {
+        bool neverDrop = (eventPolicy(event, &props) == EventPolicyNeverDrop);
+        if (!ringPush(panel->ring, event, props,
+          neverDrop ? 0: RING_RESERVE)) {
+            atomic_fetch_add(&eventsRingFull, 1);
+            FFX_LOG("FAILED TO QUEUE EVENT: %02x", event);
+            return false;
+        }
+    }
+
+    // Only the running Panels need waking; the others drain their ring
+    // once resumed (or while the running loop is idle). Check before
+    // the exchange, since the loop is usually awake.
+    if (atomic_load(&sleeping) && isRunning(panel) &&
+      atomic_exchange(&sleeping, false)) {
+        xSemaphoreGive(wake);
     }
 
     return true;
 }
 
+// Drain every ring on the stack, so events for covered Panels are
+// coalesced into their lanes rather than overflowing the ring
+static void drainRings() {
+    FfxEvent event;
+    FfxEventProps props;
+
+    PanelContext *panel = atomic_load(&active);
+    for (; panel; panel = panel->parent) {
+        while (ringPop(panel->ring, &event, &props)) {
+            laneEvent(panel, event, props);
+        }
+
+        if (atomic_load(&panel->renderPending) &&
+          atomic_exchange(&panel->renderPending, false)) {
+            laneEvent(panel, FfxEventRenderScene, (FfxEventProps){
+                .render = {
+                    .ticks = atomic_load(&panel->renderTicks),
+                    .dt = atomic_exchange(&panel->renderDt, 0)
+                }
+            });
+        }
+    }
+}
+
+// Take the next event for %%panel%%, priority lane first
+static bool nextEvent(PanelContext *panel, EventDispatch *dispatch) {
+    return lanePop(&panel->lanes[LanePriority], dispatch) ||
+      lanePop(&panel->lanes[LaneNormal], dispatch);
+}
+
+// The caller must be counted in emitters
+static PanelContext* findPanel(int panelId) {
+    PanelContext *panel = atomic_load(&active);
+    for (; panel; panel = panel->parent) {
+        if (panel->id == panelId) { return panel; }
+    }
+    return NULL;
+}
+
+bool ffx_emitEvent(FfxEvent event, FfxEventProps props) {
+    if (event >= _FfxEventCount) { return false; }
+
+    atomic_fetch_add(&emitters, 1);
+
+    PanelContext *panel = atomic_load(&active);
+    bool result = panel ? queueEvent(panel, event, props): false;
+
+    // Covered Panels only see the event if subscribed
+    if (panel && (subscribableEvents & (1 << event))) {
+        uint32_t bit = (1 << event);
+        for (panel = panel->parent; panel; panel = panel->parent) {
+            if (!(atomic_load(&panel->subscriptions) & bit)) { continue; }
+            queueEvent(panel, event, props);
+        }
+    }
+
+    atomic_fetch_sub(&emitters, 1);
+
+    return result;
+}
+
+bool panel_emitEvent(int panelId, FfxEvent event, FfxEventProps props) {
+    if (event >= _FfxEventCount) { return false; }
+
+    atomic_fetch_add(&emitters, 1);
+
+    PanelContext *panel = findPanel(panelId);
+    bool result = panel ? queueEvent(panel, event, props): false;
+
+    atomic_fetch_sub(&emitters, 1);
+
+    return result;
+}
+
+bool panel_isAlive(int panelId) {
+    atomic_fetch_add(&emitters, 1);
+    bool result = (findPanel(panelId) != NULL);
+    atomic_fetch_sub(&emitters, 1);
+    return result;
+}
+
+bool panel_guard(int panelId) {
+    atomic_fetch_add(&emitters, 1);
+    PanelContext *panel = findPanel(panelId);
+    return (panel && !atomic_load(&panel->closing));
+}
+
+void panel_unguard() {
+    atomic_fetch_sub(&emitters, 1);
+}
+
+int panel_currentId() {
+    PanelContext *ctx = (void*)xTaskGetApplicationTaskTag(NULL);
+    return ctx ? ctx->id: 0;
+}
+
 bool ffx_hasEvent(FfxEvent event) {
     if (event >= _FfxEventCount) { return false; }
 
     PanelContext *ctx = (void*)xTaskGetApplicationTaskTag(NULL);
-    if (ctx != active) { FFX_LOG("hmmm\n"); }
     return (ctx != NULL && ctx->events[event] != NULL);
 }
 
@@ -101,7 +595,6 @@ bool ffx_onEvent(FfxEvent event, FfxEventFunc callback, void *arg) {
     if (event >= _FfxEventCount) { return false; }
 
     PanelContext *ctx = (void*)xTaskGetApplicationTaskTag(NULL);
-    if (ctx != active) { FFX_LOG("hmmm\n"); }
     if (ctx == NULL) { return false; }
 
     bool existing = !!ctx->events[event];
@@ -116,61 +609,291 @@ bool ffx_offEvent(FfxEvent event) {
     if (event >= _FfxEventCount) { return false; }
 
     PanelContext *ctx = (void*)xTaskGetApplicationTaskTag(NULL);
-    if (ctx != active) { FFX_LOG("hmmm\n"); }
     if (ctx == NULL || ctx->events[event] == NULL) { return false; }
 
+    atomic_fetch_and(&ctx->subscriptions, ~(1 << event));
+
     ctx->events[event] = NULL;
     ctx->eventsArg[event] = NULL;
 
     return true;
 }
 
+bool ffx_subscribeEvent(FfxEvent event) {
+    if (event >= _FfxEventCount) { return false; }
+    if (!(subscribableEvents & (1 << event))) { return false; }
+
+    PanelContext *ctx = (void*)xTaskGetApplicationTaskTag(NULL);
+    if (ctx == NULL || ctx->events[event] == NULL) { return false; }
+
+    atomic_fetch_or(&ctx->subscriptions, 1 << event);
+
+    return true;
+}
+
+bool ffx_unsubscribeEvent(FfxEvent event) {
+    if (event >= _FfxEventCount) { return false; }
+
+    PanelContext *ctx = (void*)xTaskGetApplicationTaskTag(NULL);
+    if (ctx == NULL) { return false; }
+
+    uint32_t bit = (1 << event);
+    return !!(atomic_fetch_and(&ctx->subscriptions, ~bit) & bit);
+}
+
 
 ///////////////////////////////
-// Panel Internals
+// Scene Reclaim
+
+// Popped Panel trees are parked off screen immediately but removed by
+// the IO task one per frame, and only with spare frame time, so several
+// pops do not land in a single frame. Each removal still frees a whole
+// tree in one ffx_sceneNode_remove; firefly-scene offers no way to walk
+// a group's children, so the cost of a single large tree is moved off
+// the pop, not bounded. The list is appended by animation callbacks (IO
+// task) and ffx_popPanel (app task).
+static FfxNode reclaimList[MAX_RECLAIM] = { 0 };
+static int reclaimCount = 0;
+static portMUX_TYPE reclaimLock = portMUX_INITIALIZER_UNLOCKED;
+
+typedef struct ReclaimStats {
+    uint32_t trees;
+
+    // Frames left to watch after the most recent pop
+    int watch;
+    int64_t worst;
+
+    // The worst frame time following a pop, most recent and overall
+    int64_t lastWorst;
+    int64_t maxWorst;
+} ReclaimStats;
+
+static ReclaimStats reclaimStats = { 0 };
+
+static void queueReclaim(FfxNode node) {
+    // Already off screen after a slide; an instant pop leaves it in place
+    ffx_sceneNode_setPosition(node, (FfxPoint){ .x = 240, .y = 0 });
+
+    portENTER_CRITICAL(&reclaimLock);
+    bool queued = (reclaimCount < MAX_RECLAIM);
+    if (queued) { reclaimList[reclaimCount++] = node; }
+    portEXIT_CRITICAL(&reclaimLock);
+
+    if (!queued) {
+        FFX_LOG("reclaim list full; removing now");
+        ffx_sceneNode_remove(node);
+    }
+}
 
-typedef struct PanelInit {
-    FfxPanelInitFunc init;
-    int id;
-    size_t stateSize;
-    void *arg;
-    PanelStyle style;
+// Remove the oldest tree, returning false if there is nothing to reclaim
+static bool reclaimTree() {
+    portENTER_CRITICAL(&reclaimLock);
+    FfxNode node = NULL;
+    if (reclaimCount) {
+        node = reclaimList[0];
+        reclaimCount--;
+        memmove(&reclaimList[0], &reclaimList[1],
+          reclaimCount * sizeof(FfxNode));
+    }
+    portEXIT_CRITICAL(&reclaimLock);
+
+    if (node == NULL) { return false; }
+
+    ffx_sceneNode_remove(node);
+    reclaimStats.trees++;
+
+    return true;
+}
+
+void panel_reclaim(int64_t frameStart, int64_t frameDeadline) {
+    if (esp_timer_get_time() < frameDeadline - RECLAIM_MARGIN) {
+        reclaimTree();
+    }
+
+    // Track the worst frame following a pop
+    if (reclaimStats.watch == 0) { return; }
+
+    int64_t dt = esp_timer_get_time() - frameStart;
+    if (dt > reclaimStats.worst) { reclaimStats.worst = dt; }
+
+    reclaimStats.watch--;
+    if (reclaimStats.watch == 0) {
+        reclaimStats.lastWorst = reclaimStats.worst;
+        if (reclaimStats.worst > reclaimStats.maxWorst) {
+            reclaimStats.maxWorst = reclaimStats.worst;
+        }
+        FFX_LOG("pop: worst-frame=%lldus", reclaimStats.worst);
+    }
+}
 
-    SemaphoreHandle_t done;
-    uint32_t result;
-} PanelInit;
+
+///////////////////////////////
+// Panel Pool
+
+// The event queue storage and state for a Panel. Blocks are allocated
+// on first use and retained in their size class when the Panel pops, so
+// navigating does not churn the heap. Only the app task pushes and
+// pops Panels, so no lock is needed.
+typedef struct PanelBlock {
+    struct PanelBlock *next;
+
+    // The pool size class; -1 if oversized
+    int sizeClass;
+
+    PanelContext context;
+
+    EventRing ring;
+    EventDispatch priorityStore[MAX_PRIORITY_BACKLOG];
+    EventDispatch normalStore[MAX_EVENT_BACKLOG];
+
+    uint8_t state[] __attribute__((aligned(8)));
+} PanelBlock;
+
+static PanelBlock *poolFree[POOL_CLASS_COUNT] = { 0 };
+static int poolCount[POOL_CLASS_COUNT] = { 0 };
+
+// The bytes held by idle blocks across all classes
+static size_t poolRetained = 0;
+
+static size_t blockSize(int sizeClass) {
+    return sizeof(PanelBlock) + poolClassSize[sizeClass];
+}
+
+typedef struct PoolStats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t oversized;
+
+    uint32_t pushes;
+    int64_t pushTotal;
+    int64_t pushMax;
+
+    uint32_t pops;
+    int64_t popTotal;
+    int64_t popMax;
+
+    // The deepest nesting and the least stack free at any push
+    int depthMax;
+    size_t headroomMin;
+    uint32_t refused;
+} PoolStats;
+
+static PoolStats poolStats = { 0 };
+
+// Returns NULL if the heap is exhausted
+static PanelBlock* acquireBlock(size_t stateSize) {
+    int sizeClass = -1;
+    for (int i = 0; i < POOL_CLASS_COUNT; i++) {
+        if (stateSize <= poolClassSize[i]) {
+            sizeClass = i;
+            break;
+        }
+    }
+
+    PanelBlock *block = NULL;
+
+    if (sizeClass >= 0 && poolFree[sizeClass]) {
+        block = poolFree[sizeClass];
+        poolFree[sizeClass] = block->next;
+        poolRetained -= blockSize(sizeClass);
+        poolStats.hits++;
+
+    } else {
+        size_t size = (sizeClass >= 0) ? poolClassSize[sizeClass]: stateSize;
+        block = malloc(sizeof(PanelBlock) + size);
+        if (block == NULL) { return NULL; }
+
+        block->sizeClass = sizeClass;
+        if (sizeClass >= 0) {
+            poolCount[sizeClass]++;
+            poolStats.misses++;
+        } else {
+            poolStats.oversized++;
+        }
+    }
+
+    block->next = NULL;
+    memset(block->state, 0, stateSize);
+
+    return block;
+}
+
+static void releaseBlock(PanelBlock *block) {
+    int sizeClass = block->sizeClass;
+
+    // Retain up to the class limit and the total cap; any excess (from
+    // a deep stack) is returned to the heap
+    if (sizeClass >= 0 && poolCount[sizeClass] <= poolClassLimit[sizeClass] &&
+      poolRetained + blockSize(sizeClass) <= POOL_RETAIN_MAX) {
+        block->next = poolFree[sizeClass];
+        poolFree[sizeClass] = block;
+        poolRetained += blockSize(sizeClass);
+        return;
+    }
+
+    if (sizeClass >= 0) { poolCount[sizeClass]--; }
+    free(block);
+}
+
+void panel_dumpStats() {
+    FFX_LOG("panel pool: hits=%ld misses=%ld oversized=%ld retained=%d/%d "
+      "overhead=%d", poolStats.hits, poolStats.misses, poolStats.oversized,
+      (int)poolRetained, POOL_RETAIN_MAX, (int)sizeof(PanelBlock));
+
+    FFX_LOG("panel events: coalesced=%ld spilled=%ld dropped=%ld "
+      "ring-full=%u", eventsCoalesced, eventsSpilled, eventsDropped,
+      atomic_load(&eventsRingFull));
+
+    for (int i = 0; i < POOL_CLASS_COUNT; i++) {
+        int idle = 0;
+        for (PanelBlock *b = poolFree[i]; b; b = b->next) { idle++; }
+        FFX_LOG("panel pool: class=%d size=%d blocks=%d idle=%d", i,
+          (int)poolClassSize[i], poolCount[i], idle);
+    }
+
+    FFX_LOG("panel push: count=%ld avg=%lldus max=%lldus",
+      poolStats.pushes,
+      poolStats.pushes ? poolStats.pushTotal / poolStats.pushes: 0,
+      poolStats.pushMax);
+    FFX_LOG("panel pop: count=%ld avg=%lldus max=%lldus",
+      poolStats.pops,
+      poolStats.pops ? poolStats.popTotal / poolStats.pops: 0,
+      poolStats.popMax);
+    FFX_LOG("panel stack: depth-max=%d headroom-min=%d refused=%ld",
+      poolStats.depthMax, (int)poolStats.headroomMin, poolStats.refused);
+
+    FFX_LOG("panel reclaim: trees=%ld pending=%d worst-frame=%lldus "
+      "(max=%lldus)", reclaimStats.trees, reclaimCount,
+      reclaimStats.lastWorst, reclaimStats.maxWorst);
+
+    // Fragmentation; the largest block which could still be allocated
+    // compared to the total free
+    size_t freeSize = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    FFX_LOG("heap: free=%d largest=%d fragmentation=%d%%", (int)freeSize,
+      (int)largest, freeSize ? 100 - (int)((100 * largest) / freeSize): 0);
+}
+
+
+///////////////////////////////
+// Panel Internals
 
 static void _panelFirstFocus(FfxNode node, FfxSceneActionStop stopType,
   void *arg) {
     ffx_emitEvent(FfxEventFocus, (FfxEventProps){
-        .panel = { .id = active->id, .firstFocus = true }
+        .panel = { .id = atomic_load(&active)->id, .firstFocus = true }
     });
 }
 
 static void _panelBlur(FfxNode node, FfxSceneActionStop stopType, void *arg) {
-    // Remove the node from the scene graph
-    ffx_sceneNode_remove(node);
+    // Remove the node from the scene graph, in a later frame
+    queueReclaim(node);
 }
 
-static void initFunc(void *_arg) {
-    // Copy the PanelInit so we can unblock the caller and it can
-    // free this from its stack (by returning)
-
-    PanelInit *panelInit = _arg;
-
-    PanelStyle style = panelInit->style;
+static void panelShow(PanelContext *panel, PanelContext *oldPanel,
+  FfxPanelInitFunc init, void *arg) {
 
-    // Create the panel state
-    size_t stateSize = panelInit->stateSize ? panelInit->stateSize: 1;
-    uint8_t state[stateSize];
-    memset(state, 0, stateSize);
-
-    // Create an incoming event queue
-    StaticQueue_t eventQueue;
-    uint8_t eventStore[MAX_EVENT_BACKLOG * sizeof(EventDispatch)];
-    QueueHandle_t events = xQueueCreateStatic(MAX_EVENT_BACKLOG,
-      sizeof(EventDispatch), eventStore, &eventQueue);
-    assert(events != NULL);
+    PanelStyle style = panel->style;
 
     FfxPoint pNewStart = { 0 };
     FfxPoint pNewEnd = { 0 };
@@ -188,32 +911,20 @@ static void initFunc(void *_arg) {
             break;
     }
 
-    FfxNode node = ffx_scene_createGroup(scene);
+    FfxNode node = panel->node;
     ffx_sceneNode_setPosition(node, pNewStart);
 
-    PanelContext *oldPanel = active;
-
-    // Create the Panel context (attached to the task tag)
-    PanelContext panel = {
-         .id = panelInit->id,
-         .state = state,
-         .eventQueue = events,
-         .node = node,
-         .parent = oldPanel,
-         .style = style,
-         .done = panelInit->done,
-         .result = &panelInit->result,
-    };
-
-    vTaskSetApplicationTaskTag(NULL, (void*)&panel);
-
-    active = &panel;
-
     // Initialize the Panel with the callback
-    panelInit->init(scene, panel.node, panel.state, panelInit->arg);
+    init(scene, node, panel->state, arg);
+
+    // The Panel popped itself during init; it was never shown
+    if (panel->popped) { return; }
 
     ffx_sceneGroup_appendChild(canvas, node);
 
+    // @TODO: Detach the covered Panel once it is off screen (and
+    //        re-append it on pop), so the scene skips its subtree; this
+    //        needs a firefly-scene call which detaches without freeing
     if (oldPanel && (pOldEnd.x != 0 || pOldEnd.y != 0)) {
         if (style == PanelStyleInstant) {
             ffx_sceneNode_setPosition(oldPanel->node, pOldEnd);
@@ -234,29 +945,196 @@ static void initFunc(void *_arg) {
     } else {
         _panelFirstFocus(NULL, FfxSceneActionStopFinal, NULL);
     }
+}
 
-    FFX_LOG("panel: begin event dispatch");
+// An emitter may have read the Panel before it was unpublished; wait
+// for it to finish before reclaiming the block, returning the result
+static int reclaimPanel(PanelContext *panel) {
+    while (atomic_load(&emitters)) { vTaskDelay(1); }
 
-    uint32_t lastStatsTime = 0;
+    int result = panel->result;
+    int64_t popStart = panel->popStart;
 
-    // Begin the event loop
-    EventDispatch dispatch = { 0 };
-    while (1) {
-        BaseType_t result = xQueueReceive(events, &dispatch, 1000);
+    releaseBlock(panel->block);
+
+    int64_t dt = esp_timer_get_time() - popStart;
+    poolStats.pops++;
+    poolStats.popTotal += dt;
+    if (dt > poolStats.popMax) { poolStats.popMax = dt; }
+
+    return result;
+}
+
+// An async Panel popped; reclaim it and tell the parent (now active)
+static void finishAsync(PanelContext *panel) {
+    int id = panel->id;
+    PanelContext *parent = panel->parent;
+
+    int result = reclaimPanel(panel);
+
+    if (parent == NULL) { return; }
 
+    panel_emitEvent(parent->id, FfxEventFocus, (FfxEventProps){
+        .panel = { .id = parent->id, .childId = id, .childresult = result }
+    });
+}
+
+// Dispatch one event for the Panels which are running, from the Active
+// Panel down to %%base%%; the Panels beneath an async child are not
+// blocked, so they keep receiving their events too
+static bool dispatchNext(PanelContext *base) {
+    drainRings();
+
+    void *tag = xTaskGetApplicationTaskTag(NULL);
+
+    PanelContext *panel = atomic_load(&active);
+    for (; panel; panel = panel->parent) {
+        EventDispatch dispatch;
+        if (nextEvent(panel, &dispatch)) {
+            vTaskSetApplicationTaskTag(NULL, (void*)panel);
+            dispatch.callback(dispatch.event, dispatch.props, dispatch.arg);
+            vTaskSetApplicationTaskTag(NULL, tag);
+
+            if (panel->popped && panel->async) { finishAsync(panel); }
+
+            return true;
+        }
+
+        // The parent is blocked in ffx_pushPanel (or is not ours)
+        if (panel == base || !panel->async) { break; }
+    }
+
+    return false;
+}
+
+// Dispatch events until %%panel%% is popped
+static void runEventLoop(PanelContext *panel) {
+    FFX_LOG("panel: begin event dispatch: id=%d", panel->id);
+
+    uint32_t lastStatsTime = 0;
+
+    while (!panel->popped) {
         if ((ticks() - lastStatsTime) > 60000) {
             lastStatsTime = ticks();
             FFX_LOG("high-water: %u", uxTaskGetStackHighWaterMark(NULL));
         }
 
-        if (result != pdPASS) { continue; }
+        if (dispatchNext(panel)) { continue; }
 
-        if (dispatch.event == FfxEventRenderScene) {
-            active->flags &= ~PanelFlagsHasRender;
+        // Producers only give the semaphore while we are sleeping, so
+        // re-check after announcing it, or a wake could be missed
+        atomic_store(&sleeping, true);
+        if (dispatchNext(panel)) {
+            atomic_store(&sleeping, false);
+            continue;
         }
 
-        dispatch.callback(dispatch.event, dispatch.props, dispatch.arg);
+        xSemaphoreTake(wake, 1000);
+        atomic_store(&sleeping, false);
+    }
+}
+
+// The number of event loops nested on the app task (blocking pushes)
+static int depth = 0;
+
+// The bytes free on the calling task's stack below the current frame;
+// the stack grows down from its end to the start
+static size_t stackHeadroom() {
+    uint8_t here = 0;
+    return &here - pxTaskGetStackStart(NULL);
+}
+
+// Create the Panel, make it active and run its init, returning NULL if
+// the caller is not the Active Panel, the app task stack is too deep or
+// the state cannot be allocated
+static PanelContext* createPanel(FfxPanelInitFunc init, size_t stateSize,
+  void *arg, bool async) {
+
+    static int nextPanelId = 1;
+
+    PanelContext *oldPanel = (void*)xTaskGetApplicationTaskTag(NULL);
+
+    // A Panel running beneath an async child must wait for it to pop;
+    // the child would otherwise be left out of the new Panel's parents
+    if (oldPanel != atomic_load(&active)) {
+        FFX_LOG("cannot push from covered panel: id=%d", oldPanel->id);
+        return NULL;
+    }
+
+    // Fail cleanly rather than overflow the stack in a nested handler
+    size_t headroom = stackHeadroom();
+    if ((!async && depth == MAX_PANEL_DEPTH) ||
+      headroom < MIN_PUSH_HEADROOM) {
+        poolStats.refused++;
+        FFX_LOG("cannot push panel: depth=%d headroom=%d", depth,
+          (int)headroom);
+        return NULL;
     }
+
+    if (poolStats.headroomMin == 0 || headroom < poolStats.headroomMin) {
+        poolStats.headroomMin = headroom;
+    }
+
+    // All Panels run on the task which pushed the root Panel
+    static TaskHandle_t panelTask = NULL;
+    if (panelTask == NULL) {
+        panelTask = xTaskGetCurrentTaskHandle();
+        wake = xSemaphoreCreateBinaryStatic(&wakeBuffer);
+    }
+    assert(panelTask == xTaskGetCurrentTaskHandle());
+
+    int64_t t0 = esp_timer_get_time();
+
+    // Create the panel state and incoming event lanes
+    PanelBlock *block = acquireBlock(stateSize);
+    if (block == NULL) {
+        poolStats.refused++;
+        FFX_LOG("cannot push panel: out of memory (state=%d)",
+          (int)stateSize);
+        return NULL;
+    }
+
+    ringInit(&block->ring);
+
+    PanelContext *panel = &block->context;
+    *panel = (PanelContext){
+         .id = nextPanelId++,
+         .block = block,
+         .state = block->state,
+         .ring = &block->ring,
+         .closing = false,
+         .subscriptions = 0,
+         .renderPending = false,
+         .renderTicks = 0,
+         .renderDt = 0,
+         .lanes = {
+             [LanePriority] = {
+                 .entries = block->priorityStore,
+                 .capacity = MAX_PRIORITY_BACKLOG
+             },
+             [LaneNormal] = {
+                 .entries = block->normalStore,
+                 .capacity = MAX_EVENT_BACKLOG
+             },
+         },
+         .node = ffx_scene_createGroup(scene),
+         .parent = oldPanel,
+         .async = async,
+         .style = oldPanel ? PanelStyleSlideLeft: PanelStyleSlideUp,
+    };
+
+    vTaskSetApplicationTaskTag(NULL, (void*)panel);
+
+    atomic_store(&active, panel);
+
+    int64_t dt = esp_timer_get_time() - t0;
+    poolStats.pushes++;
+    poolStats.pushTotal += dt;
+    if (dt > poolStats.pushMax) { poolStats.pushMax = dt; }
+
+    panelShow(panel, oldPanel, init, arg);
+
+    return panel;
 }
 
 
@@ -264,53 +1142,78 @@ static void initFunc(void *_arg) {
 // Panel API
 
 int ffx_pushPanel(FfxPanelInitFunc init, size_t stateSize, void *arg) {
+    void *tag = xTaskGetApplicationTaskTag(NULL);
 
-    static int nextPanelId = 1;
-    int panelId = nextPanelId++;
+    PanelContext *panel = createPanel(init, stateSize, arg, false);
+    if (panel == NULL) { return FFX_PANEL_REFUSED; }
 
-    char name[configMAX_TASK_NAME_LEN];
-    snprintf(name, sizeof(name), "panel-%d", panelId);
+    depth++;
+    if (depth > poolStats.depthMax) { poolStats.depthMax = depth; }
 
-    StaticSemaphore_t doneBuffer;
+    // Run the child event loop nested within the parent's handler; the
+    // parent's events are queued until this returns
+    runEventLoop(panel);
 
-    TaskHandle_t handle = NULL;
+    depth--;
 
-    PanelStyle style = active ? PanelStyleSlideLeft: PanelStyleSlideUp;
+    // Resume the parent (ffx_popPanel has already made it active)
+    vTaskSetApplicationTaskTag(NULL, tag);
 
-    PanelInit panelInit = {
-        .id = panelId,
-        .init = init,
-        .style = style,
-        .stateSize = stateSize,
-        .arg = arg,
-        .done = xSemaphoreCreateBinaryStatic(&doneBuffer)
-    };
+    return reclaimPanel(panel);
+}
+
+int ffx_pushPanelAsync(FfxPanelInitFunc init, size_t stateSize, void *arg) {
+    void *tag = xTaskGetApplicationTaskTag(NULL);
+
+    // The root Panel has no loop to run the child
+    if (tag == NULL) { return 0; }
 
-    BaseType_t status = xTaskCreatePinnedToCore(&initFunc, name,
-      (16 * 256) + ((stateSize + 3) / 4), &panelInit, uxTaskPriorityGet(NULL),
-      &handle, 0);
-    assert(handle != NULL);
+    PanelContext *panel = createPanel(init, stateSize, arg, true);
+    if (panel == NULL) { return 0; }
 
-    xSemaphoreTake(panelInit.done, portMAX_DELAY);
+    int id = panel->id;
 
-    return panelInit.result;
+    vTaskSetApplicationTaskTag(NULL, tag);
+
+    // Popped during init; it was never shown
+    if (panel->popped) { finishAsync(panel); }
+
+    return id;
 }
 
 void ffx_popPanel(int result) {
     PanelContext *panel = (void*)xTaskGetApplicationTaskTag(NULL);
+    if (panel == NULL || panel->popped) { return; }
+
+    // A Panel running beneath an async child must wait for it to pop
+    if (panel != atomic_load(&active)) {
+        FFX_LOG("cannot pop covered panel: id=%d", panel->id);
+        return;
+    }
+
+    panel->popStart = esp_timer_get_time();
 
-    active = panel->parent;
+    // Watch the frames through the transition and teardown
+    reclaimStats.watch = RECLAIM_WATCH;
+    reclaimStats.worst = 0;
 
-    FfxNode activeNode = active ? active->node: ffx_scene_createGroup(scene);
+    timers_cancelPanel(panel->id);
 
-    // Store the result of the panel on the Panel owner's stack
-    *(panel->result) = result;
+    // Refuse new events, then route emitters to the parent
+    atomic_store(&panel->closing, true);
+    atomic_store(&active, panel->parent);
+
+    PanelContext *parent = panel->parent;
+    FfxNode activeNode = parent ? parent->node: ffx_scene_createGroup(scene);
+
+    // Returned from the corresponding ffx_pushPanel
+    panel->result = result;
 
     if (panel->style == PanelStyleInstant) {
         ffx_sceneNode_setPosition(activeNode, (FfxPoint){
             .x = 0, .y = 0
         });
-        _panelBlur(scene, FfxSceneActionStopFinal, panel->node);
+        _panelBlur(panel->node, FfxSceneActionStopFinal, NULL);
 
     } else {
         FfxPoint pNewStart = ffx_sceneNode_getPosition(activeNode);
@@ -334,7 +1237,7 @@ void ffx_popPanel(int result) {
             ffx_sceneNode_animatePosition(panel->node, pOldEnd, 0, 300,
               FfxCurveEaseInQuad, _panelBlur, NULL);
         } else {
-            _panelBlur(scene, FfxSceneActionStopFinal, panel->node);
+            _panelBlur(panel->node, FfxSceneActionStopFinal, NULL);
         }
 
         if (pNewStart.x != 0 || pNewStart.y != 0) {
@@ -343,10 +1246,7 @@ void ffx_popPanel(int result) {
         }
     }
 
-    // Unblock the parent Panel
-    xSemaphoreGive(panel->done);
-
-    // Farewell...
-    vTaskDelete(NULL);
+    // Stop the event loop; the caller's handler returns normally and
+    // the parent resumes in ffx_pushPanel
+    panel->popped = true;
 }
-
@@ -1,6 +1,6 @@
 #include "esp_log.h"
 #include "esp_random.h"
-#include "nvs_flash.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOSConfig.h"
 
 // BLE
@@ -18,8 +18,10 @@
 #include "firefly-hollows.h"
 #include "firefly-tx.h"
 
+#include "ble-bonds.h"
 #include "build-defs.h"
 #include "config.h"
+#include "hollows.h"
 #include "utils.h"
 
 
@@ -38,29 +40,6 @@ typedef enum ConnState {
     ConnStateEncrypted      = (1 << 2),
 } ConnState;
 
-typedef struct Connection {
-    ConnState state;
-    uint32_t connId;
-
-    uint32_t version;
-
-    bool clearToSend;
-
-    // Task Handle to notify the BLE Task loop to wake up
-    TaskHandle_t task;
-
-    uint8_t address[6];
-    uint8_t own_addr_type;
-
-    // BLE connection and characteristic handles
-    uint16_t conn_handle;
-    uint16_t content;
-    uint16_t logger;
-    uint16_t battery_handle;
-
-    bool enabled;
-} Connection;
-
 #define MAX_LOGGER_LENGTH           (256)
 
 typedef struct Log {
@@ -69,6 +48,10 @@ typedef struct Log {
 
     char data[MAX_LOGGER_LENGTH];
     size_t offset, length;
+
+    // The connection subscribed to the logger characteristic; only that
+    // connection drains the log (0 if none)
+    uint32_t connId;
 } Log;
 
 typedef enum MessageState {
@@ -115,8 +98,9 @@ typedef struct Message {
 
     MessageState state;
 
-    // The buffer to hold an incoming message
-    uint8_t data[MAX_MESSAGE_SIZE + CBOR_OVERHEAD];
+    // The shared message buffer while this message owns it (from the
+    // first chunk received until the reply is sent); otherwise NULL
+    uint8_t *data;
 
     // Next expected offset for the incoming message
     size_t offset;
@@ -126,12 +110,93 @@ typedef struct Message {
 } Message;
 
 
-static Connection conn = { 0 };
-static Message msg = { 0 };
+#define COMMAND_QUEUE_LENGTH    (8)
+
+typedef struct CommandQueue {
+    StaticSemaphore_t lockBuffer;
+    SemaphoreHandle_t lock;
+    uint32_t queue[COMMAND_QUEUE_LENGTH];
+    size_t start;
+    size_t length;
+} CommandQueue;
+
+
+// The number of centrals which may be connected at the same time. The
+// CONFIG_BT_NIMBLE_MAX_CONNECTIONS must be at least this.
+#define MAX_CONNECTIONS         (2)
+
+// A single message buffer is shared by all connections; a message owns
+// it from its first chunk until its reply has been sent, and a central
+// starting a message while another owns it gets ERROR_BUSY and retries.
+// Keeping one buffer rather than one per connection saves 16kb of RAM
+// per additional connection.
+typedef struct MessageBuffer {
+    StaticSemaphore_t lockBuffer;
+    SemaphoreHandle_t lock;
+
+    // The Message which currently owns data (NULL if free)
+    Message *owner;
+
+    uint8_t data[MAX_MESSAGE_SIZE + CBOR_OVERHEAD];
+} MessageBuffer;
+
+typedef struct Connection {
+    ConnState state;
+    uint32_t connId;
+
+    bool clearToSend;
+
+    // BLE connection handle
+    uint16_t conn_handle;
+
+    // When the link was established, whether the peer was bonded then
+    // and whether it re-paired (its bond was stale); used to report the
+    // time to encryption and whether it was resumed from a bond or
+    // required a fresh pairing
+    uint32_t connectTime;
+    bool bonded;
+    bool repaired;
+
+    // When the in-flight indication was sent (in us); for the RTT stats
+    int64_t indicateTime;
+
+    // Pending command requests and responses for this connection
+    CommandQueue commands;
+
+    // The message slot for this connection
+    Message msg;
+} Connection;
+
+typedef struct Radio {
+    uint32_t version;
+
+    // Task Handle to notify the BLE Task loop to wake up
+    TaskHandle_t task;
+
+    uint8_t address[6];
+    uint8_t own_addr_type;
+
+    // BLE characteristic handles (shared by all connections)
+    uint16_t content;
+    uint16_t logger;
+    uint16_t battery_handle;
+
+    bool enabled;
+} Radio;
+
+
+static Radio radio = { 0 };
+static Connection conns[MAX_CONNECTIONS] = { 0 };
 static Log log = { 0 };
+static MessageBuffer messageBuffer = { 0 };
 
 
-bool ffx_isConnected() { return !!(conn.state & ConnStateConnected); }
+bool ffx_isConnected() {
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (conns[i].state & ConnStateConnected) { return true; }
+    }
+    return false;
+}
 
 
 ///////////////////////////////
@@ -150,6 +215,32 @@ static bool compareBuffer(uint8_t *a, uint8_t *b, size_t length) {
     return true;
 }
 
+static Connection* findConnection(uint16_t conn_handle) {
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        Connection *conn = &conns[i];
+        if (!(conn->state & ConnStateConnected)) { continue; }
+        if (conn->conn_handle == conn_handle) { return conn; }
+    }
+    return NULL;
+}
+
+static Connection* findFreeConnection() {
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (!(conns[i].state & ConnStateConnected)) { return &conns[i]; }
+    }
+    return NULL;
+}
+
+// Returns the connection whose message slot holds the message %%id%%. The
+// caller must take the msg.lock and check the id again.
+static Connection* findMessage(int id) {
+    if (id == 0) { return NULL; }
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (conns[i].msg.id == id) { return &conns[i]; }
+    }
+    return NULL;
+}
+
 
 ///////////////////////////////
 // BLE Description
@@ -197,59 +288,243 @@ static bool compareBuffer(uint8_t *a, uint8_t *b, size_t length) {
 #define ERROR_UNKNOWN                               (0x8f)
 
 
+// Built-in method answered by the BLE task itself (never reaches a panel)
+#define METHOD_BLE_STATS                            ("ffx_bleStats")
+
 
 ///////////////////////////////
-// Commands
+// Statistics
+
+// Power-of-two buckets; bucket i holds values in [2^(i-1), 2^i) and the
+// last bucket also holds everything larger
+#define HISTOGRAM_BUCKETS       (20)
+
+typedef struct Histogram {
+    uint32_t count;
+    uint32_t max;
+    uint64_t total;
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+// Updated from both the NimBLE host task and the BLE task, so every
+// update and every read goes through statsLock (a Histogram total is 64
+// bits, and an unlocked increment can lose counts). The critical sections
+// only cover a few loads and stores.
+typedef struct BleStats {
+    uint32_t connects;
+    uint32_t disconnects;
+
+    uint32_t bytesIn;
+    uint32_t bytesOut;
+
+    uint32_t chunksIn;
+    uint32_t chunksOut;
+
+    uint32_t messagesIn;
+    uint32_t messagesOut;
+
+    uint32_t errorBusy;
+    uint32_t errorChecksum;
+    uint32_t errorOther;
+
+    uint32_t indicateFailed;
+
+    uint32_t commandHighWater;
+    uint32_t commandDropped;
+
+    // Indication round-trip (indicate until the confirmation); in us
+    Histogram indicateRtt;
+
+    // Time spent in processMessage (checksum, parse, dispatch); in us
+    Histogram processTime;
+} BleStats;
+
+static BleStats stats = { 0 };
+static portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED;
+
+#define STATS_ADD(name, amount) \
+  do { \
+      portENTER_CRITICAL(&statsLock); \
+      stats.name += (amount); \
+      portEXIT_CRITICAL(&statsLock); \
+  } while (0)
+
+static void recordHistogram(Histogram *histogram, uint32_t value) {
+    size_t bucket = value ? (32 - __builtin_clz(value)): 0;
+    if (bucket >= HISTOGRAM_BUCKETS) { bucket = HISTOGRAM_BUCKETS - 1; }
+
+    portENTER_CRITICAL(&statsLock);
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->total += value;
+    if (value > histogram->max) { histogram->max = value; }
+    portEXIT_CRITICAL(&statsLock);
+}
 
-#define COMMAND_QUEUE_LENGTH    (8)
+// Copy of the stats taken under the lock, for reporting
+static BleStats snapshotStats() {
+    portENTER_CRITICAL(&statsLock);
+    BleStats snapshot = stats;
+    portEXIT_CRITICAL(&statsLock);
+    return snapshot;
+}
 
-typedef struct CommandQueue {
-    StaticSemaphore_t lockBuffer;
-    SemaphoreHandle_t lock;
-    uint32_t queue[COMMAND_QUEUE_LENGTH];
-    size_t start;
-    size_t length;
-} CommandQueue;
+static void dumpHistogram(const char *name, const Histogram *histogram) {
+    uint32_t avg = histogram->count ? histogram->total / histogram->count: 0;
+    printf("  %s: count=%ld avg=%ldus max=%ldus\n    ", name,
+      histogram->count, avg, histogram->max);
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (histogram->buckets[i] == 0) { continue; }
+        printf(" <%dus:%ld", 1 << i, histogram->buckets[i]);
+    }
+    printf("\n");
+}
 
-static CommandQueue commands = { 0 };
+static void appendHistogram(FfxCborBuilder *builder, const Histogram *histogram) {
+    ffx_cbor_appendMap(builder, 4);
 
+    ffx_cbor_appendString(builder, "count");
+    ffx_cbor_appendNumber(builder, histogram->count);
 
-static void queueCommand(uint32_t entry) {
+    ffx_cbor_appendString(builder, "max");
+    ffx_cbor_appendNumber(builder, histogram->max);
 
-    xSemaphoreTake(commands.lock, portMAX_DELAY);
+    ffx_cbor_appendString(builder, "total");
+    ffx_cbor_appendNumber(builder, histogram->total);
 
-    if (commands.length < COMMAND_QUEUE_LENGTH) {
-        size_t offset = commands.start + commands.length;
-        commands.queue[offset % COMMAND_QUEUE_LENGTH] = entry;
-        commands.length++;
+    ffx_cbor_appendString(builder, "buckets");
+    ffx_cbor_appendArray(builder, HISTOGRAM_BUCKETS);
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        ffx_cbor_appendNumber(builder, histogram->buckets[i]);
     }
+}
+
+// Append the stats as a CBOR map; used by the METHOD_BLE_STATS reply
+static void appendStats(FfxCborBuilder *builder) {
+    BleStats snapshot = snapshotStats();
+
+    ffx_cbor_appendMap(builder, 16);
+
+    #define APPEND_COUNTER(name) \
+      do { \
+          ffx_cbor_appendString(builder, #name); \
+          ffx_cbor_appendNumber(builder, snapshot.name); \
+      } while (0)
+
+    APPEND_COUNTER(connects);
+    APPEND_COUNTER(disconnects);
+    APPEND_COUNTER(bytesIn);
+    APPEND_COUNTER(bytesOut);
+    APPEND_COUNTER(chunksIn);
+    APPEND_COUNTER(chunksOut);
+    APPEND_COUNTER(messagesIn);
+    APPEND_COUNTER(messagesOut);
+    APPEND_COUNTER(errorBusy);
+    APPEND_COUNTER(errorChecksum);
+    APPEND_COUNTER(errorOther);
+    APPEND_COUNTER(indicateFailed);
+    APPEND_COUNTER(commandHighWater);
+    APPEND_COUNTER(commandDropped);
+
+    #undef APPEND_COUNTER
+
+    ffx_cbor_appendString(builder, "indicateRtt");
+    appendHistogram(builder, &snapshot.indicateRtt);
+
+    ffx_cbor_appendString(builder, "processTime");
+    appendHistogram(builder, &snapshot.processTime);
+}
+
+void ffx_bleDumpStats() {
+    BleStats snapshot = snapshotStats();
+
+    FFX_LOG("ble: connects=%ld disconnects=%ld", snapshot.connects,
+      snapshot.disconnects);
+    printf("  in: bytes=%ld chunks=%ld messages=%ld\n", snapshot.bytesIn,
+      snapshot.chunksIn, snapshot.messagesIn);
+    printf("  out: bytes=%ld chunks=%ld messages=%ld\n", snapshot.bytesOut,
+      snapshot.chunksOut, snapshot.messagesOut);
+    printf("  errors: busy=%ld checksum=%ld other=%ld indicate=%ld\n",
+      snapshot.errorBusy, snapshot.errorChecksum, snapshot.errorOther,
+      snapshot.indicateFailed);
+    printf("  commands: high-water=%ld/%d dropped=%ld\n",
+      snapshot.commandHighWater, COMMAND_QUEUE_LENGTH,
+      snapshot.commandDropped);
+    dumpHistogram("indicate rtt", &snapshot.indicateRtt);
+    dumpHistogram("process message", &snapshot.processTime);
+
+    bonds_dump();
+}
 
-    xSemaphoreGive(commands.lock);
+
+///////////////////////////////
+// Commands
+
+static void queueCommand(Connection *conn, uint32_t entry) {
+    CommandQueue *commands = &conn->commands;
+
+    xSemaphoreTake(commands->lock, portMAX_DELAY);
+
+    if (commands->length < COMMAND_QUEUE_LENGTH) {
+        size_t offset = commands->start + commands->length;
+        commands->queue[offset % COMMAND_QUEUE_LENGTH] = entry;
+        commands->length++;
+
+        portENTER_CRITICAL(&statsLock);
+        if (commands->length > stats.commandHighWater) {
+            stats.commandHighWater = commands->length;
+        }
+        portEXIT_CRITICAL(&statsLock);
+    } else {
+        STATS_ADD(commandDropped, 1);
+    }
+
+    xSemaphoreGive(commands->lock);
 
     // Wake up the task to send pending commands
-    xTaskNotifyGive(conn.task);
+    xTaskNotifyGive(radio.task);
+}
+
+static void queueCommandResponse(Connection *conn, uint8_t command,
+  uint8_t error) {
+    if (error == ERROR_BUSY) {
+        STATS_ADD(errorBusy, 1);
+    } else if (error == ERROR_BAD_CHECKSUM) {
+        STATS_ADD(errorChecksum, 1);
+    } else if (error) {
+        STATS_ADD(errorOther, 1);
+    }
+    return queueCommand(conn, (command << 8) | error);
 }
 
-static void queueCommandResponse(uint8_t command, uint8_t error) {
-    return queueCommand((command << 8) | error);
+static void queueCommandRequest(Connection *conn, uint8_t command) {
+    return queueCommand(conn, command << 16);
 }
 
-static void queueCommandRequest(uint8_t command) {
-    return queueCommand(command << 16);
+static void resetCommands(Connection *conn) {
+    xSemaphoreTake(conn->commands.lock, portMAX_DELAY);
+    conn->commands.start = 0;
+    conn->commands.length = 0;
+    xSemaphoreGive(conn->commands.lock);
 }
 
-static bool dequeueCommand(uint8_t *buffer, size_t *length) {
+static bool dequeueCommand(Connection *conn, uint8_t *buffer,
+  size_t *length) {
+
+    CommandQueue *commands = &conn->commands;
+    Message *msg = &conn->msg;
+
     *length = 0;
 
-    xSemaphoreTake(commands.lock, portMAX_DELAY);
+    xSemaphoreTake(commands->lock, portMAX_DELAY);
     do {
-        if (commands.length == 0) { break; }
+        if (commands->length == 0) { break; }
 
-        uint32_t entry = commands.queue[commands.start];
+        uint32_t entry = commands->queue[commands->start];
 
         // Update the circular buffer
-        commands.start = (commands.start + 1) % COMMAND_QUEUE_LENGTH;
-        commands.length--;
+        commands->start = (commands->start + 1) % COMMAND_QUEUE_LENGTH;
+        commands->length--;
 
         uint32_t cmd = (entry >> 16) & 0xff;
 
@@ -275,11 +550,11 @@ static bool dequeueCommand(uint8_t *buffer, size_t *length) {
             buffer[offset++] = CMD_QUERY;
             buffer[offset++] = 0x01;
 
-            buffer[offset++] = msg.offset >> 8;
-            buffer[offset++] = msg.offset & 0xff;
+            buffer[offset++] = msg->offset >> 8;
+            buffer[offset++] = msg->offset & 0xff;
 
-            buffer[offset++] = msg.length >> 8;
-            buffer[offset++] = msg.length & 0xff;
+            buffer[offset++] = msg->length >> 8;
+            buffer[offset++] = msg->length & 0xff;
 
             uint32_t v = ffx_deviceModelNumber();
             buffer[offset++] = (v >> 24) & 0xff;
@@ -295,7 +570,7 @@ static bool dequeueCommand(uint8_t *buffer, size_t *length) {
 
             // Early versions may be missing this; libraries should default
             // to "0.0.1" if missing
-            v = conn.version;
+            v = radio.version;
             buffer[offset++] = (v >> 24) & 0xff;
             buffer[offset++] = (v >> 16) & 0xff;
             buffer[offset++] = (v >> 8) & 0xff;
@@ -307,7 +582,7 @@ static bool dequeueCommand(uint8_t *buffer, size_t *length) {
         }
     } while(0);
 
-    xSemaphoreGive(commands.lock);
+    xSemaphoreGive(commands->lock);
 
     return (*length) != 0;
 }
@@ -316,8 +591,8 @@ static bool dequeueCommand(uint8_t *buffer, size_t *length) {
 ///////////////////////////////
 // Message
 
-// Caller must own msg.lock
-static uint32_t checkMessage(FfxCborCursor cursor) {
+// Caller must own msg->lock
+static uint32_t checkMessage(Message *msg, FfxCborCursor cursor) {
 
     // Check Method (and copy it)
     {
@@ -331,9 +606,9 @@ static uint32_t checkMessage(FfxCborCursor cursor) {
 
         size_t safeLength = MIN(data.length, MAX_METHOD_LENGTH - 1);
 
-        memset(msg.method, 0, MAX_METHOD_LENGTH);
-        memcpy(msg.method, data.bytes, safeLength);
-        msg.method[safeLength] = 0;
+        memset(msg->method, 0, MAX_METHOD_LENGTH);
+        memcpy(msg->method, data.bytes, safeLength);
+        msg->method[safeLength] = 0;
     }
 
     // Check params
@@ -343,7 +618,7 @@ static uint32_t checkMessage(FfxCborCursor cursor) {
           !ffx_cbor_checkType(&check, FfxCborTypeArray | FfxCborTypeMap)) {
             return 0;
         }
-        msg.params = check;
+        msg->params = check;
     }
 
     // Check ID
@@ -362,18 +637,45 @@ static uint32_t checkMessage(FfxCborCursor cursor) {
     }
 }
 
-// Caller MUST own msg.lock
-static void resetMessage() {
-    msg.state = MessageStateReady;
-    msg.length = 0;
-    msg.offset = 0;
+// Caller MUST own msg->lock; returns false if another message owns
+// the shared buffer
+static bool claimBuffer(Message *msg) {
+    xSemaphoreTake(messageBuffer.lock, portMAX_DELAY);
+
+    bool claimed = (messageBuffer.owner == NULL ||
+      messageBuffer.owner == msg);
+    if (claimed) {
+        messageBuffer.owner = msg;
+        msg->data = messageBuffer.data;
+    }
+
+    xSemaphoreGive(messageBuffer.lock);
+
+    return claimed;
+}
+
+// Caller MUST own msg->lock
+static void releaseBuffer(Message *msg) {
+    xSemaphoreTake(messageBuffer.lock, portMAX_DELAY);
+    if (messageBuffer.owner == msg) { messageBuffer.owner = NULL; }
+    xSemaphoreGive(messageBuffer.lock);
+
+    msg->data = NULL;
+}
+
+// Caller MUST own msg->lock
+static void resetMessage(Message *msg) {
+    msg->state = MessageStateReady;
+    msg->length = 0;
+    msg->offset = 0;
+    releaseBuffer(msg);
 }
 
-// Caller MUST own msg.lock
-static FfxCborBuilder prepareReply() {
-    memset(msg.data, 0, MAX_MESSAGE_SIZE + CBOR_OVERHEAD);
+// Caller MUST own msg->lock
+static FfxCborBuilder prepareReply(Message *msg) {
+    memset(msg->data, 0, MAX_MESSAGE_SIZE + CBOR_OVERHEAD);
 
-    FfxCborBuilder builder = ffx_cbor_build(&msg.data[32],
+    FfxCborBuilder builder = ffx_cbor_build(&msg->data[32],
       MAX_MESSAGE_SIZE + CBOR_OVERHEAD - 32);
 
     ffx_cbor_appendMap(&builder, 3);
@@ -381,89 +683,110 @@ static FfxCborBuilder prepareReply() {
     ffx_cbor_appendNumber(&builder, 1);
 
     ffx_cbor_appendString(&builder, "id");
-    ffx_cbor_appendNumber(&builder, msg.replyId);
+    ffx_cbor_appendNumber(&builder, msg->replyId);
 
-    msg.offset = 0;
+    msg->offset = 0;
 
     return builder;
 }
 
-// Caller must own msg.lock
-static void sendMessage(const FfxCborBuilder *builder) {
+// Caller must own conn->msg.lock
+static void sendMessage(Connection *conn, const FfxCborBuilder *builder) {
+    Message *msg = &conn->msg;
+
     size_t cborLength = ffx_cbor_getBuildLength(builder);
 
-    FFX_LOG(">>> (id=%ld => replyId=%ld) ", msg.id, msg.replyId);
+    FFX_LOG(">>> (conn=%ld id=%ld => replyId=%ld) ", conn->connId, msg->id,
+      msg->replyId);
     FfxCborCursor cursor = ffx_cbor_walk(builder->data, cborLength);
     ffx_cbor_dump(&cursor);
 
-    msg.length = cborLength + 32;
-    msg.state = MessageStateSending;
-    msg.id = 0;
+    msg->length = cborLength + 32;
+    msg->state = MessageStateSending;
+
+    // The request is complete; drop any speculative work for it
+    jobs_discardMessage(msg->id);
+    msg->id = 0;
 
-    ffx_hash_sha256(msg.data, &msg.data[32], cborLength);
+    STATS_ADD(messagesOut, 1);
 
-    queueCommandRequest(CMD_RESET);
+    ffx_hash_sha256(msg->data, &msg->data[32], cborLength);
+
+    queueCommandRequest(conn, CMD_RESET);
 
     // Wake up the task to send the pending message
-    xTaskNotifyGive(conn.task);
+    xTaskNotifyGive(radio.task);
 }
 
 
-// Caller must own msg.lock
-static void processMessage() {
+// Caller must own conn->msg.lock
+static void processMessage(Connection *conn) {
     static uint32_t nextMessageId = 1;
 
-    msg.id = nextMessageId++;
+    Message *msg = &conn->msg;
+
+    msg->id = nextMessageId++;
 
-    if (msg.length < 32) {
-        resetMessage();
-        queueCommandResponse(CMD_START_MESSAGE, ERROR_MISSING_MESSAGE);
+    STATS_ADD(messagesIn, 1);
+
+    if (msg->length < 32) {
+        resetMessage(msg);
+        queueCommandResponse(conn, CMD_START_MESSAGE, ERROR_MISSING_MESSAGE);
         return;
     }
 
-    //dumpBuffer("Process Message", msg.data, msg.length);
+    //dumpBuffer("Process Message", msg->data, msg->length);
 
     uint8_t checksum[32];
     //FfxSha256Context ctx;
     //ffx_hash_initSha256(&ctx);
-    //ffx_hash_updateSha256(&ctx, &msg.data[32], msg.length - 32);
+    //ffx_hash_updateSha256(&ctx, &msg->data[32], msg->length - 32);
     //ffx_hash_finalSha256(&ctx, checksum);
-    ffx_hash_sha256(checksum, &msg.data[32], msg.length - 32);
+    ffx_hash_sha256(checksum, &msg->data[32], msg->length - 32);
 
-    if (!compareBuffer(checksum, msg.data, sizeof(checksum))) {
-        resetMessage();
-        queueCommandResponse(CMD_START_MESSAGE, ERROR_BAD_CHECKSUM);
+    if (!compareBuffer(checksum, msg->data, sizeof(checksum))) {
+        resetMessage(msg);
+        queueCommandResponse(conn, CMD_START_MESSAGE, ERROR_BAD_CHECKSUM);
         return;
     }
 
-    msg.payload = ffx_cbor_walk(&msg.data[32], msg.length - 32);
+    msg->payload = ffx_cbor_walk(&msg->data[32], msg->length - 32);
 
-    msg.replyId = checkMessage(msg.payload);
+    msg->replyId = checkMessage(msg, msg->payload);
 
     // Dump the CBOR data to the console
-    FFX_LOG("<<< (id=%ld => replyId=%ld) ", msg.id, msg.replyId);
-    ffx_cbor_dump(&msg.payload);
+    FFX_LOG("<<< (conn=%ld id=%ld => replyId=%ld) ", conn->connId, msg->id,
+      msg->replyId);
+    ffx_cbor_dump(&msg->payload);
+
+    // Built-in stats request; answered without involving the panels
+    if (msg->replyId && strcmp(msg->method, METHOD_BLE_STATS) == 0) {
+        msg->state = MessageStateProcessing;
+
+        FfxCborBuilder builder = prepareReply(msg);
+        ffx_cbor_appendString(&builder, "result");
+        appendStats(&builder);
+
+        sendMessage(conn, &builder);
 
-    if (msg.replyId) {
-        msg.state = MessageStateReceived;
-printf("FOO: %ld %s\n", msg.id, msg.method);
-ffx_cbor_dump(&msg.params);
+    } else if (msg->replyId) {
+        msg->state = MessageStateReceived;
 
         // The params gets cloned within the emitMessageEvents.
         bool accept = ffx_emitEvent(FfxEventMessage, (FfxEventProps){
             .message = {
-                .id = msg.id,
-                .method = msg.method,
-                .params = &msg.params
+                .id = msg->id,
+                .method = msg->method,
+                .params = &msg->params
             }
         });
 
         if (accept) {
-            msg.state = MessageStateProcessing;
+            msg->state = MessageStateProcessing;
 
         } else {
             // No panels are currently processing messages
-            FfxCborBuilder builder = prepareReply();
+            FfxCborBuilder builder = prepareReply(msg);
 
             // Append the Error payload (error: { code, message })
             ffx_cbor_appendString(&builder, "error");
@@ -476,126 +799,149 @@ ffx_cbor_dump(&msg.params);
                 ffx_cbor_appendString(&builder, "NOT READY");
             }
 
-            sendMessage(&builder);
+            sendMessage(conn, &builder);
         }
 
     } else {
-        resetMessage();
+        resetMessage(msg);
     }
 }
 
+// Caller must own conn->msg.lock
+static void processMessageTimed(Connection *conn) {
+    int64_t t0 = esp_timer_get_time();
+    processMessage(conn);
+    recordHistogram(&stats.processTime, esp_timer_get_time() - t0);
+}
+
 ///////////////////////////////
 // BLE goop
 
 
-static void handleRequest(uint8_t *req, size_t length) {
+static void handleRequest(Connection *conn, uint8_t *req, size_t length) {
+    Message *msg = &conn->msg;
 
     switch (req[0]) {
         case CMD_QUERY:
-            queueCommandResponse(CMD_QUERY, STATUS_OK);
+            queueCommandResponse(conn, CMD_QUERY, STATUS_OK);
             break;
 
         case CMD_RESET:
-            xSemaphoreTake(msg.lock, portMAX_DELAY);
+            xSemaphoreTake(msg->lock, portMAX_DELAY);
 
             // Not in a state ready to receive
-            if (msg.state != MessageStateReady &&
-              msg.state != MessageStateReceiving) {
-                xSemaphoreGive(msg.lock);
-                queueCommandResponse(CMD_RESET, ERROR_BUSY);
+            if (msg->state != MessageStateReady &&
+              msg->state != MessageStateReceiving) {
+                xSemaphoreGive(msg->lock);
+                queueCommandResponse(conn, CMD_RESET, ERROR_BUSY);
                 break;
             }
 
-            msg.replyId = 0;
-            resetMessage();
+            msg->replyId = 0;
+            resetMessage(msg);
 
-            xSemaphoreGive(msg.lock);
+            xSemaphoreGive(msg->lock);
 
             break;
 
         case CMD_START_MESSAGE: {
-            xSemaphoreTake(msg.lock, portMAX_DELAY);
+            xSemaphoreTake(msg->lock, portMAX_DELAY);
 
             // Not ready to start a new message
-            if (msg.state != MessageStateReady) {
-                xSemaphoreGive(msg.lock);
-                queueCommandResponse(CMD_START_MESSAGE, ERROR_BUSY);
+            if (msg->state != MessageStateReady) {
+                xSemaphoreGive(msg->lock);
+                queueCommandResponse(conn, CMD_START_MESSAGE, ERROR_BUSY);
                 break;
             }
 
             // Missing length parameter
             if (length < 3) {
-                xSemaphoreGive(msg.lock);
-                queueCommandResponse(CMD_START_MESSAGE, ERROR_BUFFER_OVERRUN);
+                xSemaphoreGive(msg->lock);
+                queueCommandResponse(conn, CMD_START_MESSAGE,
+                  ERROR_BUFFER_OVERRUN);
                 break;
             }
 
             uint16_t msgLen = (req[1] << 8) | req[2];
 
             // No message or a message is already started
-            if (msgLen == 0 || length < 4 || msg.offset != 0) {
-                xSemaphoreGive(msg.lock);
-                queueCommandResponse(CMD_START_MESSAGE, ERROR_MISSING_MESSAGE);
+            if (msgLen == 0 || length < 4 || msg->offset != 0) {
+                xSemaphoreGive(msg->lock);
+                queueCommandResponse(conn, CMD_START_MESSAGE,
+                  ERROR_MISSING_MESSAGE);
+                break;
+            }
+
+            // Another connection's message holds the shared buffer
+            if (!claimBuffer(msg)) {
+                xSemaphoreGive(msg->lock);
+                queueCommandResponse(conn, CMD_START_MESSAGE, ERROR_BUSY);
                 break;
             }
 
+            STATS_ADD(chunksIn, 1);
+
             // Update the message
-            msg.length = msgLen;
-            msg.offset = length - 1 - 2;
-            msg.state = MessageStateReceiving;
-            memcpy(msg.data, &req[3], length - 1 - 2);
+            msg->length = msgLen;
+            msg->offset = length - 1 - 2;
+            msg->state = MessageStateReceiving;
+            memcpy(msg->data, &req[3], length - 1 - 2);
 
             // Message ready to process!
-            if (msg.offset == msg.length) { processMessage(); }
+            if (msg->offset == msg->length) { processMessageTimed(conn); }
 
-            xSemaphoreGive(msg.lock);
+            xSemaphoreGive(msg->lock);
 
             break;
         }
 
         case CMD_CONTINUE_MESSAGE: {
-            xSemaphoreTake(msg.lock, portMAX_DELAY);
-            if (msg.state != MessageStateReceiving) {
-                xSemaphoreGive(msg.lock);
-                queueCommandResponse(CMD_CONTINUE_MESSAGE, ERROR_BUSY);
+            xSemaphoreTake(msg->lock, portMAX_DELAY);
+            if (msg->state != MessageStateReceiving) {
+                xSemaphoreGive(msg->lock);
+                queueCommandResponse(conn, CMD_CONTINUE_MESSAGE, ERROR_BUSY);
                 break;
             }
 
             // Missing length parameter
             if (length < 3) {
-                xSemaphoreGive(msg.lock);
-                queueCommandResponse(CMD_CONTINUE_MESSAGE, ERROR_BUFFER_OVERRUN);
+                xSemaphoreGive(msg->lock);
+                queueCommandResponse(conn, CMD_CONTINUE_MESSAGE,
+                  ERROR_BUFFER_OVERRUN);
                 break;
             }
 
             uint16_t msgOffset = (req[1] << 8) | req[2];
 
             // No message to continue
-            if (msg.offset == 0 || length < 4 || msgOffset != msg.offset) {
-                xSemaphoreGive(msg.lock);
-                queueCommandResponse(CMD_CONTINUE_MESSAGE, ERROR_MISSING_MESSAGE);
+            if (msg->offset == 0 || length < 4 || msgOffset != msg->offset) {
+                xSemaphoreGive(msg->lock);
+                queueCommandResponse(conn, CMD_CONTINUE_MESSAGE,
+                  ERROR_MISSING_MESSAGE);
                 break;
             }
 
+            STATS_ADD(chunksIn, 1);
+
             // Update the message
-            msg.offset += length - 1 - 2;
-            memcpy(&msg.data[msgOffset], &req[3], length - 1 - 2);
+            msg->offset += length - 1 - 2;
+            memcpy(&msg->data[msgOffset], &req[3], length - 1 - 2);
 
             // Message ready to process!
-            if (msg.offset == msg.length) { processMessage(); }
+            if (msg->offset == msg->length) { processMessageTimed(conn); }
 
-            xSemaphoreGive(msg.lock);
+            xSemaphoreGive(msg->lock);
 
             break;
         }
 
         default:
-            queueCommandResponse(req[0], ERROR_BAD_COMMAND);
+            queueCommandResponse(conn, req[0], ERROR_BAD_COMMAND);
             break;
     }
 }
 
-// 
+//
 static int gattAccess(uint16_t conn_handle, uint16_t attr_handle,
   struct ble_gatt_access_ctxt *ctx, void *arg) {
 
@@ -620,24 +966,32 @@ static int gattAccess(uint16_t conn_handle, uint16_t attr_handle,
         ////////////////////
         // Write operation (host-to-device)
 
+        Connection *conn = findConnection(conn_handle);
+        if (conn == NULL) {
+            FFX_LOG("write fail: unknown connHandle=%d", conn_handle);
+            return BLE_ATT_ERR_UNLIKELY;
+        }
+
         size_t length = os_mbuf_len(ctx->om);
+        STATS_ADD(bytesIn, length);
+
         if (length == 0) {
-            queueCommandResponse(0, ERROR_BUFFER_OVERRUN);
+            queueCommandResponse(conn, 0, ERROR_BUFFER_OVERRUN);
 
         } else if (length > 513) {
             uint8_t req[1];
             int rc = os_mbuf_copydata(ctx->om, 0, 1, req);
             if (rc) { FFX_LOG("write fail: rc=%d\n", rc); }
-            queueCommandResponse(req[0], ERROR_BUFFER_OVERRUN);
+            queueCommandResponse(conn, req[0], ERROR_BUFFER_OVERRUN);
 
         } else {
             uint8_t req[length];
             int rc = os_mbuf_copydata(ctx->om, 0, length, req);
             if (rc) {
                 FFX_LOG("write fail: rc=%d\n", rc);
-                queueCommandResponse(0, ERROR_BUFFER_OVERRUN);
+                queueCommandResponse(conn, 0, ERROR_BUFFER_OVERRUN);
             } else {
-                handleRequest(req, length);
+                handleRequest(conn, req, length);
             }
         }
 
@@ -656,6 +1010,18 @@ static int gattAccess(uint16_t conn_handle, uint16_t attr_handle,
         return (rc == 0) ? 0: BLE_ATT_ERR_INSUFFICIENT_RES;
     }
 
+    // The model name is only known once the provisioning data has
+    // loaded; this waits for it the first time, if the prime task has
+    // not loaded it yet
+    if (uuid == UUID_CHR_MODEL_NUMBER_STRING) {
+        ffx_deviceLoad();
+
+        char modelName[32] = { 0 };
+        ffx_deviceModelName(modelName, sizeof(modelName) - 1);
+        int rc = os_mbuf_append(ctx->om, modelName, strlen(modelName));
+        return (rc == 0) ? 0: BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+
     // Reading the Content handle isn't supported; use indicate
     if (uuid == UUID_CHR_FSP_CONTENT) {
         int rc = os_mbuf_append(ctx->om, NULL, 0);
@@ -706,6 +1072,17 @@ static void gattsRegister(struct ble_gatt_register_ctxt *ctxt, void *arg) {
 static int gapEvent(struct ble_gap_event *event, void *arg);
 
 static void advertise() {
+
+    // Already advertising (e.g. a connection dropped while there was
+    // still a free slot)
+    if (ble_gap_adv_active()) { return; }
+
+    // All connection slots are in use; advertising resumes on disconnect
+    if (findFreeConnection() == NULL) {
+        FFX_LOG("all connections in use; not advertising");
+        return;
+    }
+
     FFX_LOG("start advertising");
 
     struct ble_hs_adv_fields fields;
@@ -751,25 +1128,28 @@ static void advertise() {
 
     // Begin advertising
     {
-        int rc = ble_gap_adv_start(conn.own_addr_type, NULL,
+        int rc = ble_gap_adv_start(radio.own_addr_type, NULL,
           BLE_HS_FOREVER, &adv_params, gapEvent, NULL);
 
         if (rc != 0) {
             MODLOG_DFLT(ERROR, "error enabling advertisement; rc=%d\n", rc);
             return;
         }
+
+        // Only the first advertisement is recorded
+        boot_end(BootPhaseAdvertise);
     }
 }
 
 static void onSync(void) {
     int rc;
 
-    rc = ble_hs_id_infer_auto(0, &conn.own_addr_type);
+    rc = ble_hs_id_infer_auto(0, &radio.own_addr_type);
     assert(rc == 0);
 
-    rc = ble_hs_id_copy_addr(conn.own_addr_type, conn.address, NULL);
+    rc = ble_hs_id_copy_addr(radio.own_addr_type, radio.address, NULL);
 
-    print_addr("sync addr=", conn.address);
+    print_addr("sync addr=", radio.address);
 
     advertise();
 }
@@ -782,53 +1162,116 @@ static void onReset(int reason) {
 static int gapEvent(struct ble_gap_event *event, void *_context) {
 
     switch (event->type) {
-        case BLE_GAP_EVENT_CONNECT:
+        case BLE_GAP_EVENT_CONNECT: {
             // A new connection was established or a connection attempt failed
-            FFX_LOG("connect: status=%s (%d)\n",
+            FFX_LOG("connect: status=%s (%d) connHandle=%d\n",
               event->connect.status == 0 ? "established" : "failed",
-              event->connect.status);
+              event->connect.status, event->connect.conn_handle);
 
             //Connection failed; resume advertising
             if (event->connect.status != 0) {
                 advertise();
+                return 0;
+            }
 
-            } else {
-                static uint32_t nextConnId = 1;
+            Connection *conn = findFreeConnection();
 
-                conn.conn_handle = event->connect.conn_handle;
-                conn.connId = nextConnId++;
-                conn.state = ConnStateConnected;
+            // Advertising stops once all slots are used, so this should
+            // not happen; but if it does, turn away the central
+            if (conn == NULL) {
+                FFX_LOG("no free connection; terminating");
+                ble_gap_terminate(event->connect.conn_handle,
+                  BLE_ERR_CONN_LIMIT);
+                return 0;
+            }
 
-                resetMessage();
+            static uint32_t nextConnId = 1;
 
-                ffx_emitEvent(FfxEventRadioState, (FfxEventProps){
-                    .radio = {
-                        .id = conn.connId,
-                        .radioOn = true,
-                        .connected = true
-                    }
-                });
-            }
+            resetCommands(conn);
 
-            return 0;
+            xSemaphoreTake(conn->msg.lock, portMAX_DELAY);
+            conn->msg.id = 0;
+            conn->msg.replyId = 0;
+            resetMessage(&conn->msg);
+            xSemaphoreGive(conn->msg.lock);
 
-        case BLE_GAP_EVENT_DISCONNECT:
-            FFX_LOG("disconnect: reason=%d\n", event->disconnect.reason);
+            conn->conn_handle = event->connect.conn_handle;
+            conn->connId = nextConnId++;
+            conn->clearToSend = true;
+            conn->state = ConnStateConnected;
+            conn->connectTime = ticks();
 
-            conn.state = 0;
-            conn.conn_handle = 0;
+            STATS_ADD(connects, 1);
+            conn->repaired = false;
+
+            // For a bonded peer, request security right away so the
+            // central resumes encryption with the stored LTK, rather than
+            // waiting for an FSP access to fail with insufficient
+            // encryption (and possibly re-pairing)
+            {
+                struct ble_gap_conn_desc desc;
+                int rc = ble_gap_conn_find(conn->conn_handle, &desc);
+                conn->bonded = (rc == 0 && bonds_isBonded(&desc.peer_id_addr));
+                if (conn->bonded) {
+                    rc = ble_gap_security_initiate(conn->conn_handle);
+                    if (rc) { FFX_LOG("security initiate: rc=%d", rc); }
+                }
+            }
 
             ffx_emitEvent(FfxEventRadioState, (FfxEventProps){
                 .radio = {
-                    .id = conn.connId,
+                    .id = conn->connId,
                     .radioOn = true,
-                    .connected = false
+                    .connected = true
                 }
             });
 
+            // Advertising stops on connect; keep accepting other
+            // centrals while there are free slots
+            advertise();
+
+            return 0;
+        }
+
+        case BLE_GAP_EVENT_DISCONNECT: {
+            FFX_LOG("disconnect: reason=%d connHandle=%d\n",
+              event->disconnect.reason, event->disconnect.conn.conn_handle);
+
+            Connection *conn = findConnection(
+              event->disconnect.conn.conn_handle);
+
+            if (conn) {
+                STATS_ADD(disconnects, 1);
+
+                conn->state = 0;
+                conn->conn_handle = 0;
+                conn->clearToSend = true;
+
+                // Any in-flight message is abandoned; replies to it will
+                // be rejected
+                xSemaphoreTake(conn->msg.lock, portMAX_DELAY);
+                jobs_discardMessage(conn->msg.id);
+                conn->msg.id = 0;
+                resetMessage(&conn->msg);
+                xSemaphoreGive(conn->msg.lock);
+
+                xSemaphoreTake(log.lock, portMAX_DELAY);
+                if (log.connId == conn->connId) { log.connId = 0; }
+                xSemaphoreGive(log.lock);
+
+                ffx_emitEvent(FfxEventRadioState, (FfxEventProps){
+                    .radio = {
+                        .id = conn->connId,
+                        .radioOn = true,
+                        .connected = false
+                    }
+                });
+            }
+
             // Connection terminated; resume advertising
             advertise();
             return 0;
+        }
 
         case BLE_GAP_EVENT_CONN_UPDATE:
             FFX_LOG("conn_update: status=%d\n", event->conn_update.status);
@@ -846,27 +1289,49 @@ static int gapEvent(struct ble_gap_event *event, void *_context) {
 
             return 0;
 
-        case BLE_GAP_EVENT_SUBSCRIBE:
+        case BLE_GAP_EVENT_SUBSCRIBE: {
             FFX_LOG("subscribe: connHandle=%d, attrHandle=%d reason=%d prevNotify=%d curNotify=%d prevIndicate=%d curIndicate=%d\n",
               event->subscribe.conn_handle, event->subscribe.attr_handle,
               event->subscribe.reason, event->subscribe.prev_notify,
               event->subscribe.cur_notify, event->subscribe.prev_indicate,
               event->subscribe.cur_indicate);
 
-            conn.state |= ConnStateSubscribed;
+            Connection *conn = findConnection(event->subscribe.conn_handle);
+            if (conn) { conn->state |= ConnStateSubscribed; }
+
+            // The log goes to the first connection subscribed to the
+            // logger, until it unsubscribes or disconnects
+            if (conn && event->subscribe.attr_handle == radio.logger) {
+                bool on = event->subscribe.cur_notify ||
+                  event->subscribe.cur_indicate;
+                xSemaphoreTake(log.lock, portMAX_DELAY);
+                if (on && log.connId == 0) {
+                    log.connId = conn->connId;
+                } else if (!on && log.connId == conn->connId) {
+                    log.connId = 0;
+                }
+                xSemaphoreGive(log.lock);
+            }
 
             return 0;
+        }
 
-        case BLE_GAP_EVENT_NOTIFY_TX:
+        case BLE_GAP_EVENT_NOTIFY_TX: {
             FFX_LOG("notify_tx status=%d indication=%d\n",
               event->notify_tx.status, event->notify_tx.indication);
 
             if (event->notify_tx.status == BLE_HS_EDONE) {
-                conn.clearToSend = true;
-                xTaskNotifyGive(conn.task);
+                Connection *conn = findConnection(event->notify_tx.conn_handle);
+                if (conn) {
+                    conn->clearToSend = true;
+                    recordHistogram(&stats.indicateRtt,
+                      esp_timer_get_time() - conn->indicateTime);
+                }
+                xTaskNotifyGive(radio.task);
             }
 
             return 0;
+        }
 
         case BLE_GAP_EVENT_MTU:
             FFX_LOG("mtu: connHandle=%d channelId=%d mtu=%d\n",
@@ -879,6 +1344,13 @@ static int gapEvent(struct ble_gap_event *event, void *_context) {
 
             // @TODO: Should notify the user?
 
+            Connection *conn = findConnection(
+              event->repeat_pairing.conn_handle);
+            if (conn) { conn->repaired = true; }
+
+            // The central has lost its keys for us (our LTK resumption
+            // was refused), so only this peer's stale bond is dropped;
+            // other bonds remain untouched
             struct ble_gap_conn_desc desc;
             int rc = ble_gap_conn_find(event->repeat_pairing.conn_handle, &desc);
             assert(rc == 0);
@@ -941,10 +1413,24 @@ static int gapEvent(struct ble_gap_event *event, void *_context) {
               event->phy_updated.tx_phy, event->phy_updated.tx_phy);
             return 0;
 
-        case BLE_GAP_EVENT_ENC_CHANGE:
+        case BLE_GAP_EVENT_ENC_CHANGE: {
             FFX_LOG("enc change: status=%d connHandle=%d\n",
               event->enc_change.status, event->enc_change.conn_handle);
+
+            Connection *conn = findConnection(event->enc_change.conn_handle);
+            if (conn && event->enc_change.status == 0) {
+                conn->state |= ConnStateEncrypted;
+
+                // Tracked per connection, so a pairing on another link
+                // cannot be mistaken for this one
+                bool resumed = (conn->bonded && !conn->repaired);
+                FFX_LOG("encrypted: connId=%ld mode=%s dt=%ldms",
+                  conn->connId, resumed ? "resumed": "paired",
+                  ticks() - conn->connectTime);
+            }
+
             return 0;
+        }
 
         case BLE_GAP_EVENT_DATA_LEN_CHG:
             FFX_LOG("len change: connHandle=%d max_tx_octets=%d max_tx_time=%d max_rx_octets=%d max_rx_time=%d\n",
@@ -985,10 +1471,10 @@ static void runTask() {
 // Panel API
 
 void panel_enableMessage(bool enable) {
-    conn.enabled = enable;
+    radio.enabled = enable;
 }
 
-bool panel_isMessageEnabled() { return conn.enabled; }
+bool panel_isMessageEnabled() { return radio.enabled; }
 
 /*
 bool panel_acceptMessage(uint32_t id, FfxCborCursor *params) {
@@ -1015,16 +1501,24 @@ bool ffx_sendErrorReply(int id, uint32_t code, const char *message) {
     size_t length = strlen(message);
     if (id == 0 || length > 128) { return false; }
 
-    xSemaphoreTake(msg.lock, portMAX_DELAY);
+    Connection *conn = findMessage(id);
+    if (conn == NULL) {
+        FFX_LOG("Wrong error reply: id=%d (no connection)\n", id);
+        return false;
+    }
+
+    Message *msg = &conn->msg;
+
+    xSemaphoreTake(msg->lock, portMAX_DELAY);
 
-    if (id != msg.id || msg.state != MessageStateProcessing) {
+    if (id != msg->id || msg->state != MessageStateProcessing) {
         FFX_LOG("Wrong error reply: id=%d msg.id=%ld replyId=%ld\n", id,
-          msg.id, msg.replyId);
-        xSemaphoreGive(msg.lock);
+          msg->id, msg->replyId);
+        xSemaphoreGive(msg->lock);
         return false;
     }
 
-    FfxCborBuilder builder = prepareReply();
+    FfxCborBuilder builder = prepareReply(msg);
 
     // Append the Error payload (error: { code, message })
     ffx_cbor_appendString(&builder, "error");
@@ -1037,9 +1531,9 @@ bool ffx_sendErrorReply(int id, uint32_t code, const char *message) {
         ffx_cbor_appendString(&builder, message);
     }
 
-    sendMessage(&builder);
+    sendMessage(conn, &builder);
 
-    xSemaphoreGive(msg.lock);
+    xSemaphoreGive(msg->lock);
 
     return true;
 }
@@ -1047,50 +1541,67 @@ bool ffx_sendErrorReply(int id, uint32_t code, const char *message) {
 bool ffx_sendReply(int id, const FfxCborBuilder *result) {
     if (id == 0) { return false; }
 
-    xSemaphoreTake(msg.lock, portMAX_DELAY);
+    Connection *conn = findMessage(id);
+    if (conn == NULL) {
+        FFX_LOG("Wrong reply: id=%d (no connection)\n", id);
+        return false;
+    }
 
-    if (id == 0 || id != msg.id || msg.state != MessageStateProcessing ||
+    Message *msg = &conn->msg;
+
+    xSemaphoreTake(msg->lock, portMAX_DELAY);
+
+    if (id == 0 || id != msg->id || msg->state != MessageStateProcessing ||
       ffx_cbor_getBuildLength(result) > MAX_MESSAGE_SIZE) {
-        FFX_LOG("Wrong reply: id=%d msg.id=%ld replyId=%ld\n", id, msg.id,
-          msg.replyId);
+        FFX_LOG("Wrong reply: id=%d msg.id=%ld replyId=%ld\n", id, msg->id,
+          msg->replyId);
 
-        xSemaphoreGive(msg.lock);
+        xSemaphoreGive(msg->lock);
         return false;
     }
 
-    FfxCborBuilder builder = prepareReply();
+    FfxCborBuilder builder = prepareReply(msg);
 
     // Append the payload
     ffx_cbor_appendString(&builder, "result");
     ffx_cbor_appendCborBuilder(&builder, result);
 
-    sendMessage(&builder);
+    sendMessage(conn, &builder);
 
-    xSemaphoreGive(msg.lock);
+    xSemaphoreGive(msg->lock);
 
     return true;
 }
 
 bool ffx_disconnect() {
-    if (!(conn.state & ConnStateConnected)) { return false; }
+    bool found = false;
 
-    int rc = ble_gap_terminate(conn.conn_handle, BLE_ERR_REM_USER_CONN_TERM);
-    if (rc != 0) {
-        FFX_LOG("Failed to disconnect; rc = %d\n", rc);
-    } else {
-        FFX_LOG("Disconnect initiated\n");
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        Connection *conn = &conns[i];
+        if (!(conn->state & ConnStateConnected)) { continue; }
+
+        found = true;
+
+        int rc = ble_gap_terminate(conn->conn_handle,
+          BLE_ERR_REM_USER_CONN_TERM);
+        if (rc != 0) {
+            FFX_LOG("Failed to disconnect; connId=%ld rc=%d\n", conn->connId,
+              rc);
+        } else {
+            FFX_LOG("Disconnect initiated; connId=%ld\n", conn->connId);
+        }
     }
 
-    return true;
+    return found;
 }
 
 ///////////////////////////////
 // BLE Task API
 
-static bool sendLog(uint8_t *buffer, size_t *length) {
+static bool sendLog(Connection *conn, uint8_t *buffer, size_t *length) {
     xSemaphoreTake(log.lock, portMAX_DELAY);
 
-    if (log.length) {
+    if (log.length && log.connId == conn->connId) {
         size_t l = log.length;
         if (l > MAX_LOGGER_LENGTH) { l = MAX_LOGGER_LENGTH; }
 
@@ -1112,48 +1623,97 @@ static bool sendLog(uint8_t *buffer, size_t *length) {
     return (*length) != 0 ;
 }
 
-static bool sendMessageChunk(uint8_t *buffer, size_t *length) {
-    xSemaphoreTake(msg.lock, portMAX_DELAY);
+static bool sendMessageChunk(Connection *conn, uint8_t *buffer,
+  size_t *length) {
+
+    Message *msg = &conn->msg;
+
+    xSemaphoreTake(msg->lock, portMAX_DELAY);
 
     *length = 0;
 
-    if (msg.state != MessageStateSending) {
-        xSemaphoreGive(msg.lock);
+    if (msg->state != MessageStateSending) {
+        xSemaphoreGive(msg->lock);
         return false;
     }
 
-    size_t remaining = msg.length - msg.offset;
+    size_t remaining = msg->length - msg->offset;
     if (remaining > 506) { remaining = 506; }
 
-    if (msg.offset == 0) {
+    if (msg->offset == 0) {
         buffer[0] = CMD_START_MESSAGE;
-        buffer[1] = msg.length >> 8;
-        buffer[2] = msg.length & 0xff;
+        buffer[1] = msg->length >> 8;
+        buffer[2] = msg->length & 0xff;
 
     } else {
         buffer[0] = CMD_CONTINUE_MESSAGE;
-        buffer[1] = msg.offset >> 8;
-        buffer[2] = msg.offset & 0xff;
+        buffer[1] = msg->offset >> 8;
+        buffer[2] = msg->offset & 0xff;
     }
 
-    memcpy(&buffer[3], &msg.data[msg.offset], remaining);
-    msg.offset += remaining;
+    memcpy(&buffer[3], &msg->data[msg->offset], remaining);
+    msg->offset += remaining;
+
+    STATS_ADD(chunksOut, 1);
 
     *length = remaining + 3;
 
-    if ((msg.length - msg.offset) == 0) { resetMessage(); }
+    if ((msg->length - msg->offset) == 0) { resetMessage(msg); }
 
-    xSemaphoreGive(msg.lock);
+    xSemaphoreGive(msg->lock);
 
     return true;
 }
 
-// TEMP
-void ble_store_config_init(void);
+// Sends the next pending command, message chunk or log for %%conn%%,
+// returning true if an indication was started
+static bool sendPending(Connection *conn, uint8_t *buffer) {
+    if (!(conn->state & ConnStateConnected) || !conn->clearToSend) {
+        return false;
+    }
+
+    size_t length = 0;
+
+    uint16_t handle = radio.content;
+
+    if (dequeueCommand(conn, buffer, &length)) {
+        // Pending command; it has been copied to buffer and
+        // length updated
+
+    } else if (sendMessageChunk(conn, buffer, &length)) {
+        // Pending outgoing message; it has been copied to buffer
+        // and length updated
+
+    } else if (sendLog(conn, buffer, &length)) {
+        // Pending log; it has been copied to buffer and length updated
+        handle = radio.logger;
+    }
+
+    if (length == 0) { return false; }
+
+    //printf("[ble] indicate: conn=%ld length=%d header=%02x%02x\n",
+    //  conn->connId, length, buffer[0], (length > 1) ? buffer[1]: 0);
+
+    struct os_mbuf *om = ble_hs_mbuf_from_flat(buffer, length);
+    conn->clearToSend = false;
+    conn->indicateTime = esp_timer_get_time();
+    int rc = ble_gatts_indicate_custom(conn->conn_handle, handle, om);
+    if (rc) {
+        FFX_LOG("indicate fail: conn=%ld handle=%d rc=%d\n", conn->connId,
+          handle, rc);
+        STATS_ADD(indicateFailed, 1);
+        conn->clearToSend = true;
+        return false;
+    }
+
+    STATS_ADD(bytesOut, length);
+
+    return true;
+}
 
 void taskBleFunc(void* pvParameter) {
     TaskBleInit *init = pvParameter;
-    conn.version = init->version;
+    radio.version = init->version;
 
     // The BLE has copied the init values; unblock the bootstrap process
     xSemaphoreGive(init->ready);
@@ -1162,28 +1722,30 @@ void taskBleFunc(void* pvParameter) {
 
     TaskStatus_t task;
     vTaskGetInfo(NULL, &task, pdFALSE, pdFALSE);
-    conn.task = task.xHandle;
+    radio.task = task.xHandle;
 
-    commands.lock = xSemaphoreCreateBinaryStatic(&commands.lockBuffer);
-    xSemaphoreGive(commands.lock);
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        Connection *conn = &conns[i];
+
+        conn->commands.lock = xSemaphoreCreateBinaryStatic(
+          &conn->commands.lockBuffer);
+        xSemaphoreGive(conn->commands.lock);
+
+        conn->msg.lock = xSemaphoreCreateBinaryStatic(&conn->msg.lockBuffer);
+        xSemaphoreGive(conn->msg.lock);
+
+        conn->clearToSend = true;
+    }
 
     log.lock = xSemaphoreCreateBinaryStatic(&log.lockBuffer);
     xSemaphoreGive(log.lock);
 
-    msg.lock = xSemaphoreCreateBinaryStatic(&msg.lockBuffer);
-    xSemaphoreGive(msg.lock);
-
-    conn.clearToSend = true;
+    messageBuffer.lock = xSemaphoreCreateMutexStatic(
+      &messageBuffer.lockBuffer);
 
 
     // Device Information Service Data
 
-    char disModelNumber[32];
-    ffx_deviceModelName(disModelNumber, sizeof(disModelNumber) - 1);
-    Payload payloadDisModelNumber = {
-        .data = (uint8_t*)disModelNumber, .length = strlen(disModelNumber)
-    };
-
     Payload payloadDisManufacturerName = {
         .data = (uint8_t*)MANUFACTURER_NAME,
         .length = strlen(MANUFACTURER_NAME)
@@ -1234,7 +1796,6 @@ void taskBleFunc(void* pvParameter) {
             // Characteristic: Model number string
             .uuid = BLE_UUID16_DECLARE(UUID_CHR_MODEL_NUMBER_STRING),
             .access_cb = gattAccess,
-            .arg = &payloadDisModelNumber,
             .flags = BLE_GATT_CHR_F_READ,
         }, {
             // Characteristic: Model number string
@@ -1260,7 +1821,7 @@ void taskBleFunc(void* pvParameter) {
             // Battery Level
             .uuid = BLE_UUID16_DECLARE(UUID_CHR_BATTERY_LEVEL),
             .access_cb = gattAccess,
-            .val_handle = &conn.battery_handle,
+            .val_handle = &radio.battery_handle,
             .descriptors = (struct ble_gatt_dsc_def[]) { {
                 .uuid = BLE_UUID16_DECLARE(UUID_DSC_BATTERY_LEVEL),
                 .access_cb = gattAccess,
@@ -1281,14 +1842,14 @@ void taskBleFunc(void* pvParameter) {
             // Characteristic: Data
             .uuid = BLE_UUID16_DECLARE(UUID_CHR_FSP_CONTENT),
             .access_cb = gattAccess,
-            .val_handle = &conn.content,
+            .val_handle = &radio.content,
             .flags = BLE_GATT_CHR_F_READ | BLE_ATT_F_READ_ENC
               | BLE_ATT_F_WRITE | BLE_ATT_F_WRITE_ENC | BLE_GATT_CHR_F_INDICATE
         }, {
             // Characteristic: Log
             .uuid = BLE_UUID16_DECLARE(UUID_CHR_FSP_LOGGER),
             .access_cb = gattAccess,
-            .val_handle = &conn.logger,
+            .val_handle = &radio.logger,
             .flags = BLE_GATT_CHR_F_NOTIFY
         }, {
             0, // No more characteristics in this service
@@ -1297,16 +1858,9 @@ void taskBleFunc(void* pvParameter) {
         0, // No more services
     } };
 
-    // Initialize NVS; it is used to store PHY calibration data
+    // NVS (used to store PHY calibration data) was initialized by ffx_init
     {
-        esp_err_t status = nvs_flash_init();
-        if (status == ESP_ERR_NVS_NO_FREE_PAGES || status == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-            ESP_ERROR_CHECK(nvs_flash_erase());
-            status = nvs_flash_init();
-        }
-        ESP_ERROR_CHECK(status);
-
-        status = nimble_port_init();
+        esp_err_t status = nimble_port_init();
         if (status != ESP_OK) {
             MODLOG_DFLT(ERROR, "Failed to init nimble %d \n", status);
             return;
@@ -1318,19 +1872,19 @@ void taskBleFunc(void* pvParameter) {
     ble_hs_cfg.reset_cb = onReset;
     ble_hs_cfg.sync_cb = onSync;
 
-    //ble_hs_cfg.store_read_cb = _store_read;
-    //ble_hs_cfg.store_write_cb = _store_write;
-    //ble_hs_cfg.store_delete_cb = _store_delete;
-    //ble_hs_cfg.store_status_cb = _store_status;
-    ble_hs_cfg.store_status_cb = ble_store_util_status_rr;
-
     //ble_hs_cfg.sm_io_cap = BLE_SM_IO_CAP_DISP_ONLY;
     ble_hs_cfg.sm_io_cap = BLE_SM_IO_CAP_NO_IO;
     ble_hs_cfg.sm_bonding = 1;
     ble_hs_cfg.sm_mitm = 1;
     ble_hs_cfg.sm_sc = 1;
-    //ble_hs_cfg.sm_our_key_dist = BLE_SM_PAIR_KEY_DIST_ENC;
-    //ble_hs_cfg.sm_their_key_dist = BLE_SM_PAIR_KEY_DIST_ENC;
+
+    // Exchange the LTK and IRK during pairing, so a returning central
+    // (even using a resolvable private address) is recognized and can
+    // resume encryption without pairing again
+    ble_hs_cfg.sm_our_key_dist = BLE_SM_PAIR_KEY_DIST_ENC |
+      BLE_SM_PAIR_KEY_DIST_ID;
+    ble_hs_cfg.sm_their_key_dist = BLE_SM_PAIR_KEY_DIST_ENC |
+      BLE_SM_PAIR_KEY_DIST_ID;
 
     ble_svc_gap_init();
     ble_svc_gatt_init();
@@ -1341,70 +1895,42 @@ void taskBleFunc(void* pvParameter) {
     const char *device_name = DEVICE_NAME;
     assert(ble_svc_gap_device_name_set(device_name) == 0);
 
-    // TEMP
-    // See: components/bt//host/nimble/nimble/nimble/host/store/config/src/ble_store_config.c
-    ble_store_config_init();
+    // Install the bond store (replaces the NimBLE ble_store_config)
+    bonds_init();
 
     // Run forever
     nimble_port_freertos_init(runTask);
 
-    // Unblock the bootstrap task
-    // *ready = 1;
+    // The message queues and host are ready; the app may start
+    boot_end(BootPhaseBle);
 
     uint8_t buffer[512];
 
-    while (1) {
-
-        size_t length = 0;
-
-        uint16_t handle = conn.content;
-
-        if (!conn.clearToSend) {
-            // Wait for a notification from the notification callback
-            // letting us know the CTS is set
-            ulTaskNotifyTake(pdFALSE, 1000);
-            continue;
+    // The connection to service first; rotated each pass so a busy
+    // central cannot starve the others
+    size_t nextConn = 0;
 
-        } else if (dequeueCommand(buffer, &length)) {
-            // Pending command; it has been copied to buffer and
-            // length updated
+    while (1) {
 
-        } else if (sendMessageChunk(buffer, &length)) {
-            // Pending outgoing message; it has been copied to buffer
-            // and length updated
+        bool sent = false;
 
-        } else if (sendLog(buffer, &length)) {
-            // Pending log; it has been copied to buffer and length updated
-            handle = conn.logger;
+        for (int i = 0; i < MAX_CONNECTIONS; i++) {
+            Connection *conn = &conns[(nextConn + i) % MAX_CONNECTIONS];
+            if (sendPending(conn, buffer)) { sent = true; }
         }
 
-        if (length) {
-            //printf("[ble] indicate: length=%d header=%02x%02x\n", length,
-            //  buffer[0], (length > 1) ? buffer[1]: 0);
-
-            if ((conn.state & ConnStateConnected) == 0) {
-                FFX_LOG("indicate: not connected\n");
-                continue;
-            }
-
-            struct os_mbuf *om = ble_hs_mbuf_from_flat(buffer, length);
-            conn.clearToSend = false;
-            int rc = ble_gatts_indicate_custom(conn.conn_handle, handle, om);
-            if (rc) {
-                FFX_LOG("indicate fail: handle=%d rc=%d\n", conn.content, rc);
-                conn.clearToSend = true;
-                continue;
-            }
+        nextConn = (nextConn + 1) % MAX_CONNECTIONS;
 
-        } else {
-            // Wait for a notification from sendMessge or queueCommand
+        if (!sent) {
+            // Wait for a notification from sendMessge, queueCommand or
+            // the notification callback letting us know the CTS is set
             ulTaskNotifyTake(pdFALSE, 1000);
         }
 
         /*
         if (conn.state & STATE_SUBSCRIBED) {
             char *ping = "ping";
-            notify(conn.logger, (uint8_t*)ping, sizeof(ping));
+            notify(radio.logger, (uint8_t*)ping, sizeof(ping));
         }
         */
     }
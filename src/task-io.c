@@ -5,6 +5,7 @@
 #include <driver/gpio.h>
 #include <hal/gpio_ll.h>
 #include "esp_random.h"
+#include "esp_timer.h"
 
 #include "firefly-display.h"
 #include "firefly-scene.h"
@@ -317,6 +318,7 @@ void taskIoFunc(void* pvParameter) {
     }
 
     // The IO is ready; unblock the bootstrap process
+    boot_end(BootPhaseIo);
     xSemaphoreGive(init->ready);
 
     // How long the reset sequence has been held down for
@@ -326,6 +328,9 @@ void taskIoFunc(void* pvParameter) {
     // The special value 0 causes an immediate update
     TickType_t lastFrameTime = ticks();
 
+    // When the current frame's work began (in us)
+    int64_t frameStart = esp_timer_get_time();
+
     while (1) {
         // Sample the keypad
         keypad_sample(&keypad);
@@ -339,6 +344,9 @@ void taskIoFunc(void* pvParameter) {
         if (frameDone) {
             frameCount++;
 
+            // Only the first frame is recorded
+            boot_end(BootPhaseFirstFrame);
+
             pixels_tick(pixels);
 
             // Latch the keypad values de-bouncing with the inter-frame samples
@@ -370,6 +378,8 @@ void taskIoFunc(void* pvParameter) {
                 .render = { .ticks = now, .dt = now - lastFrameTime }
             });
 
+            timers_tick(now);
+
             {
                 static uint32_t frameCount = 0;
                 static uint32_t lastFpsUpdate = 0;
@@ -405,6 +415,9 @@ void taskIoFunc(void* pvParameter) {
               16 + (frameStagger & 0x1));
             */
 
+            // Free popped Panel scene trees in the spare frame time
+            panel_reclaim(frameStart, frameStart + 20000);
+
             // Target: 50 FPS
             BaseType_t didDelay = xTaskDelayUntil(&lastFrameTime, 20);
 
@@ -414,6 +427,8 @@ void taskIoFunc(void* pvParameter) {
                 delay(1);
                 lastFrameTime = ticks();
             }
+
+            frameStart = esp_timer_get_time();
         }
     }
 }
@@ -0,0 +1,363 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "hollows.h"
+#include "utils.h"
+
+
+// Below the Panels, so they stay responsive (and can cancel) while a
+// job is running, but above the warm-ups
+#define PRIORITY_JOBS         (2)
+
+// The number of jobs which may be pending or running
+#define MAX_JOBS              (8)
+
+
+typedef enum JobState {
+    JobStateFree = 0,
+    JobStatePending,
+    JobStateRunning,
+
+    // A speculative job which completed and is waiting to be claimed
+    JobStateDone,
+
+    // A speculative job whose results must be discarded by the worker
+    JobStateDiscard
+} JobState;
+
+typedef struct Job {
+    JobState state;
+    int id;
+    int panelId;
+
+    FfxJobFunc func;
+    void *arg;
+
+    bool cancelled;
+    int progress;
+
+    // Speculative jobs; bound to a message and kept until claimed or
+    // discarded (on cancel, reply or disconnect)
+    int messageId;
+    FfxJobDiscardFunc discardFunc;
+    bool success;
+    TaskHandle_t waiter;
+} Job;
+
+static Job jobs[MAX_JOBS] = { 0 };
+
+static int nextId = 1;
+
+static TaskHandle_t taskJobsHandle = NULL;
+
+static StaticSemaphore_t lockBuffer;
+static SemaphoreHandle_t lock = NULL;
+
+
+// Caller must own the lock
+static Job* findJob(int id) {
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (jobs[i].id == id && jobs[i].state != JobStateFree) {
+            return &jobs[i];
+        }
+    }
+    return NULL;
+}
+
+// Caller must own the lock
+static Job* nextPending() {
+    Job *result = NULL;
+    for (int i = 0; i < MAX_JOBS; i++) {
+        Job *job = &jobs[i];
+        if (job->state != JobStatePending &&
+          job->state != JobStateDiscard) {
+            continue;
+        }
+
+        // Run in the order added
+        if (result == NULL || job->id < result->id) { result = job; }
+    }
+    return result;
+}
+
+static void emitJob(int panelId, int id, FfxJobStatus status, int progress) {
+    panel_emitEvent(panelId, FfxEventJob, (FfxEventProps){
+        .job = { .id = id, .status = status, .progress = progress }
+    });
+}
+
+// Caller must own the lock; discard the results of a speculative job
+static void discardJob(Job *job) {
+    job->cancelled = true;
+
+    if (job->state == JobStateDone) {
+        if (job->success && job->discardFunc) {
+            job->state = JobStateDiscard;
+            xTaskNotifyGive(taskJobsHandle);
+        } else {
+            job->state = JobStateFree;
+        }
+    }
+
+    // A running (or pending) job is discarded once it completes
+}
+
+// A speculative job completed; keep the results for ffx_claimJob unless
+// it has already been discarded
+static void completeSpeculative(Job *job, bool success) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    job->success = success;
+
+    bool discard = (job->cancelled && success && job->discardFunc);
+
+    if (job->cancelled) {
+        job->state = discard ? JobStateRunning: JobStateFree;
+    } else {
+        job->state = JobStateDone;
+    }
+
+    TaskHandle_t waiter = job->waiter;
+    job->waiter = NULL;
+
+    xSemaphoreGive(lock);
+
+    if (discard) {
+        job->discardFunc(job->id, job->arg);
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        job->state = JobStateFree;
+        xSemaphoreGive(lock);
+    }
+
+    if (waiter) { xTaskNotifyGive(waiter); }
+}
+
+static void taskJobsFunc(void* pvParameter) {
+    vTaskSetApplicationTaskTag(NULL, (void*)NULL);
+
+    while (1) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+
+        Job *job = nextPending();
+
+        JobState state = JobStateFree;
+        if (job) {
+            state = job->state;
+            job->state = JobStateRunning;
+        }
+
+        xSemaphoreGive(lock);
+
+        // Nothing to do; wait for ffx_runJob
+        if (job == NULL) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        // Unclaimed speculative results
+        if (state == JobStateDiscard) {
+            job->discardFunc(job->id, job->arg);
+
+            xSemaphoreTake(lock, portMAX_DELAY);
+            job->state = JobStateFree;
+            xSemaphoreGive(lock);
+
+            continue;
+        }
+
+        // A job cancelled before it started is still called, so it can
+        // release any resources it holds (see ffx_isJobCancelled)
+        uint32_t t0 = ticks();
+        bool success = job->func(job->id, job->arg);
+        uint32_t dt = ticks() - t0;
+
+        // Speculative jobs are claimed rather than emitting an event
+        if (job->messageId) {
+            FFX_LOG("speculative job done: id=%d message=%d success=%d "
+              "dt=%ldms", job->id, job->messageId, success, dt);
+            completeSpeculative(job, success);
+            continue;
+        }
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+
+        int id = job->id;
+        int panelId = job->panelId;
+        bool cancelled = job->cancelled || !panel_isAlive(panelId);
+
+        job->state = JobStateFree;
+
+        xSemaphoreGive(lock);
+
+        FfxJobStatus status = FfxJobStatusFailed;
+        if (cancelled) {
+            status = FfxJobStatusCancelled;
+        } else if (success) {
+            status = FfxJobStatusDone;
+        }
+
+        FFX_LOG("job done: id=%d panel=%d status=%d dt=%ldms", id, panelId,
+          status, dt);
+
+        emitJob(panelId, id, status, 0);
+    }
+}
+
+void jobs_init() {
+    lock = xSemaphoreCreateBinaryStatic(&lockBuffer);
+    xSemaphoreGive(lock);
+}
+
+static int addJob(FfxJobFunc func, void *arg, int messageId,
+  FfxJobDiscardFunc discardFunc) {
+
+    int panelId = panel_currentId();
+    if (panelId == 0) { return 0; }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    Job *job = NULL;
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (jobs[i].state == JobStateFree) {
+            job = &jobs[i];
+            break;
+        }
+    }
+
+    if (job == NULL) {
+        xSemaphoreGive(lock);
+        FFX_LOG("job queue full");
+        return 0;
+    }
+
+    memset(job, 0, sizeof(Job));
+    job->state = JobStatePending;
+    job->id = nextId++;
+    job->panelId = panelId;
+    job->func = func;
+    job->arg = arg;
+    job->messageId = messageId;
+    job->discardFunc = discardFunc;
+
+    int id = job->id;
+
+    // Start the worker task on first use; jobs run app code such as key
+    // derivation and signing, so this matches the prime task (its
+    // high-water mark is reported by ffx_dumpStats)
+    if (taskJobsHandle == NULL) {
+        BaseType_t status = xTaskCreatePinnedToCore(&taskJobsFunc, "jobs",
+          32 * 256, NULL, PRIORITY_JOBS, &taskJobsHandle, 0);
+        assert(status && taskJobsHandle != NULL);
+    }
+
+    xSemaphoreGive(lock);
+
+    xTaskNotifyGive(taskJobsHandle);
+
+    return id;
+}
+
+int ffx_runJob(FfxJobFunc func, void *arg) {
+    return addJob(func, arg, 0, NULL);
+}
+
+int ffx_speculateJob(int messageId, FfxJobFunc func,
+  FfxJobDiscardFunc discardFunc, void *arg) {
+    if (messageId == 0) { return 0; }
+    return addJob(func, arg, messageId, discardFunc);
+}
+
+bool ffx_claimJob(int id) {
+    while (1) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+
+        Job *job = findJob(id);
+        if (job == NULL || job->messageId == 0 || job->cancelled) {
+            xSemaphoreGive(lock);
+            return false;
+        }
+
+        if (job->state == JobStateDone) {
+            bool success = job->success;
+            job->state = JobStateFree;
+            xSemaphoreGive(lock);
+            return success;
+        }
+
+        // Still pending or running; wait for it to complete
+        job->waiter = xTaskGetCurrentTaskHandle();
+
+        xSemaphoreGive(lock);
+
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
+int jobs_stackHighWater() {
+    if (taskJobsHandle == NULL) { return -1; }
+    return uxTaskGetStackHighWaterMark(taskJobsHandle);
+}
+
+void jobs_discardMessage(int messageId) {
+    if (messageId == 0) { return; }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    for (int i = 0; i < MAX_JOBS; i++) {
+        Job *job = &jobs[i];
+        if (job->state == JobStateFree || job->messageId != messageId) {
+            continue;
+        }
+        discardJob(job);
+    }
+
+    xSemaphoreGive(lock);
+}
+
+bool ffx_cancelJob(int id) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    Job *job = findJob(id);
+    if (job && job->messageId) {
+        discardJob(job);
+    } else if (job) {
+        job->cancelled = true;
+    }
+
+    xSemaphoreGive(lock);
+
+    return (job != NULL);
+}
+
+bool ffx_isJobCancelled(int id) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    Job *job = findJob(id);
+    bool cancelled = (job == NULL || job->cancelled ||
+      !panel_isAlive(job->panelId));
+
+    xSemaphoreGive(lock);
+
+    return cancelled;
+}
+
+void ffx_setJobProgress(int id, int progress) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    Job *job = findJob(id);
+
+    // Only emit changes, so a tight loop cannot flood the Panel queue
+    int panelId = 0;
+    if (job && !job->cancelled && job->progress != progress) {
+        job->progress = progress;
+        panelId = job->panelId;
+    }
+
+    xSemaphoreGive(lock);
+
+    if (panelId) { emitJob(panelId, id, FfxJobStatusProgress, progress); }
+}
@@ -0,0 +1,211 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "esp_timer.h"
+
+#include "hollows.h"
+#include "utils.h"
+
+
+// The number of warm-up jobs which may be pending or recently finished
+#define MAX_WARMUPS           (8)
+
+typedef enum WarmupState {
+    WarmupStateFree = 0,
+    WarmupStatePending,
+    WarmupStateRunning,
+    WarmupStateDone,
+    WarmupStateCancelled
+} WarmupState;
+
+typedef struct Warmup {
+    WarmupState state;
+    int id;
+
+    const char *name;
+    FfxWarmupFunc func;
+    void *arg;
+
+    // Set by ffx_cancelWarmup while the job is running
+    bool cancelled;
+
+    // The duration (in us) once done
+    int64_t duration;
+} Warmup;
+
+static Warmup warmups[MAX_WARMUPS] = { 0 };
+
+static int nextId = 1;
+
+static TaskHandle_t taskPrimeHandle = NULL;
+
+static StaticSemaphore_t lockBuffer;
+static SemaphoreHandle_t lock = NULL;
+
+
+static Warmup* findWarmup(int id) {
+    for (int i = 0; i < MAX_WARMUPS; i++) {
+        if (warmups[i].id == id && warmups[i].state != WarmupStateFree) {
+            return &warmups[i];
+        }
+    }
+    return NULL;
+}
+
+// Caller must own the lock
+static Warmup* nextPending() {
+    Warmup *result = NULL;
+    for (int i = 0; i < MAX_WARMUPS; i++) {
+        Warmup *warmup = &warmups[i];
+        if (warmup->state != WarmupStatePending) { continue; }
+
+        // Run in the order added
+        if (result == NULL || warmup->id < result->id) { result = warmup; }
+    }
+    return result;
+}
+
+// Caller must own the lock; finds a free slot, reusing the oldest
+// finished job if necessary
+static Warmup* allocWarmup() {
+    Warmup *result = NULL;
+    for (int i = 0; i < MAX_WARMUPS; i++) {
+        Warmup *warmup = &warmups[i];
+        if (warmup->state == WarmupStateFree) { return warmup; }
+
+        if (warmup->state != WarmupStateDone &&
+          warmup->state != WarmupStateCancelled) {
+            continue;
+        }
+
+        if (result == NULL || warmup->id < result->id) { result = warmup; }
+    }
+    return result;
+}
+
+void prime_init() {
+    lock = xSemaphoreCreateBinaryStatic(&lockBuffer);
+    xSemaphoreGive(lock);
+}
+
+void taskPrimeFunc(void* pvParameter) {
+    vTaskSetApplicationTaskTag(NULL, (void*) NULL);
+
+    taskPrimeHandle = xTaskGetCurrentTaskHandle();
+
+    while (1) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+
+        Warmup *warmup = nextPending();
+        if (warmup) {
+            warmup->state = WarmupStateRunning;
+            warmup->cancelled = false;
+        }
+
+        xSemaphoreGive(lock);
+
+        // Nothing to do; wait for ffx_addWarmup
+        if (warmup == NULL) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        int64_t t0 = esp_timer_get_time();
+        warmup->func(warmup->arg);
+        int64_t dt = esp_timer_get_time() - t0;
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        warmup->duration = dt;
+        warmup->state = warmup->cancelled ? WarmupStateCancelled:
+          WarmupStateDone;
+        xSemaphoreGive(lock);
+
+        FFX_LOG("warm-up done: name=%s id=%d dt=%lldus high-water=%u",
+          warmup->name, warmup->id, dt,
+          uxTaskGetStackHighWaterMark(NULL));
+    }
+}
+
+int ffx_addWarmup(const char *name, FfxWarmupFunc func, void *arg) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    Warmup *warmup = allocWarmup();
+    if (warmup == NULL) {
+        xSemaphoreGive(lock);
+        FFX_LOG("warm-up queue full: name=%s", name);
+        return 0;
+    }
+
+    memset(warmup, 0, sizeof(Warmup));
+    warmup->state = WarmupStatePending;
+    warmup->id = nextId++;
+    warmup->name = name;
+    warmup->func = func;
+    warmup->arg = arg;
+
+    int id = warmup->id;
+
+    xSemaphoreGive(lock);
+
+    if (taskPrimeHandle) { xTaskNotifyGive(taskPrimeHandle); }
+
+    return id;
+}
+
+bool ffx_cancelWarmup(int id) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    bool result = false;
+
+    Warmup *warmup = findWarmup(id);
+    if (warmup && warmup->state == WarmupStatePending) {
+        warmup->state = WarmupStateCancelled;
+        result = true;
+    } else if (warmup && warmup->state == WarmupStateRunning) {
+        warmup->cancelled = true;
+        result = true;
+    }
+
+    xSemaphoreGive(lock);
+
+    return result;
+}
+
+bool ffx_isWarmupCancelled() {
+    if (xTaskGetCurrentTaskHandle() != taskPrimeHandle) { return false; }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    bool result = false;
+    for (int i = 0; i < MAX_WARMUPS; i++) {
+        if (warmups[i].state == WarmupStateRunning) {
+            result = warmups[i].cancelled;
+            break;
+        }
+    }
+
+    xSemaphoreGive(lock);
+
+    return result;
+}
+
+void prime_dumpStats() {
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    for (int i = 0; i < MAX_WARMUPS; i++) {
+        Warmup *warmup = &warmups[i];
+        if (warmup->state == WarmupStateFree) { continue; }
+
+        static const char* const states[] = {
+            "free", "pending", "running", "done", "cancelled"
+        };
+
+        FFX_LOG("warm-up %d: name=%s state=%s dt=%lldus", warmup->id,
+          warmup->name, states[warmup->state], warmup->duration);
+    }
+
+    xSemaphoreGive(lock);
+}
@@ -0,0 +1,196 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "hollows.h"
+#include "utils.h"
+
+
+// The number of timers which may be scheduled across all Panels
+#define MAX_TIMERS          (16)
+
+// The width (in ms) of each wheel slot and the number of slots; a timer
+// further out than one revolution waits in its slot for later rounds
+#define WHEEL_RESOLUTION    (10)
+#define WHEEL_SLOTS         (64)
+
+
+typedef struct Timer {
+    struct Timer *next;
+
+    // 0 if free
+    int id;
+    int panelId;
+
+    uint32_t expires;
+
+    // 0 for a timeout
+    uint32_t period;
+} Timer;
+
+typedef struct Fired {
+    int id;
+    int panelId;
+} Fired;
+
+static Timer timers[MAX_TIMERS] = { 0 };
+static Timer *wheel[WHEEL_SLOTS] = { 0 };
+
+// The start time (in ms) of the next slot to process
+static uint32_t cursor = 0;
+
+static int nextId = 1;
+
+static StaticSemaphore_t lockBuffer;
+static SemaphoreHandle_t lock = NULL;
+
+
+// Caller must own the lock
+static void insertTimer(Timer *timer) {
+    size_t slot = (timer->expires / WHEEL_RESOLUTION) % WHEEL_SLOTS;
+    timer->next = wheel[slot];
+    wheel[slot] = timer;
+}
+
+// Caller must own the lock
+static void removeTimer(Timer *timer) {
+    size_t slot = (timer->expires / WHEEL_RESOLUTION) % WHEEL_SLOTS;
+    for (Timer **link = &wheel[slot]; *link; link = &(*link)->next) {
+        if (*link != timer) { continue; }
+        *link = timer->next;
+        break;
+    }
+    timer->id = 0;
+}
+
+// Caller must own the lock
+static Timer* findTimer(int id) {
+    for (int i = 0; i < MAX_TIMERS; i++) {
+        if (timers[i].id == id) { return &timers[i]; }
+    }
+    return NULL;
+}
+
+void timers_init() {
+    lock = xSemaphoreCreateBinaryStatic(&lockBuffer);
+    xSemaphoreGive(lock);
+
+    cursor = ticks() - (ticks() % WHEEL_RESOLUTION);
+}
+
+void timers_tick(uint32_t now) {
+    Fired fired[MAX_TIMERS];
+    int count = 0;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    // Only process a slot once it has fully elapsed, so every timer in
+    // it for this round has expired
+    while ((int32_t)(now - cursor) >= WHEEL_RESOLUTION) {
+        size_t slot = (cursor / WHEEL_RESOLUTION) % WHEEL_SLOTS;
+
+        Timer **link = &wheel[slot];
+        while (*link) {
+            Timer *timer = *link;
+
+            // A later round
+            if ((int32_t)(timer->expires - now) > 0) {
+                link = &timer->next;
+                continue;
+            }
+
+            *link = timer->next;
+
+            fired[count++] = (Fired){
+                .id = timer->id, .panelId = timer->panelId
+            };
+
+            if (timer->period) {
+                // Skip any periods missed while falling behind, rather
+                // than firing a burst
+                timer->expires += timer->period;
+                if ((int32_t)(timer->expires - now) <= 0) {
+                    timer->expires = now + timer->period;
+                }
+                insertTimer(timer);
+            } else {
+                timer->id = 0;
+            }
+        }
+
+        cursor += WHEEL_RESOLUTION;
+    }
+
+    xSemaphoreGive(lock);
+
+    for (int i = 0; i < count; i++) {
+        panel_emitEvent(fired[i].panelId, FfxEventTimer, (FfxEventProps){
+            .timer = { .id = fired[i].id }
+        });
+    }
+}
+
+void timers_cancelPanel(int panelId) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    for (int i = 0; i < MAX_TIMERS; i++) {
+        Timer *timer = &timers[i];
+        if (timer->id && timer->panelId == panelId) { removeTimer(timer); }
+    }
+
+    xSemaphoreGive(lock);
+}
+
+static int addTimer(uint32_t delay, uint32_t period) {
+    int panelId = panel_currentId();
+    if (panelId == 0) { return 0; }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    Timer *timer = findTimer(0);
+    if (timer == NULL) {
+        xSemaphoreGive(lock);
+        FFX_LOG("timers full");
+        return 0;
+    }
+
+    memset(timer, 0, sizeof(Timer));
+    timer->id = nextId++;
+    timer->panelId = panelId;
+    timer->expires = ticks() + delay;
+    timer->period = period;
+
+    insertTimer(timer);
+
+    int id = timer->id;
+
+    xSemaphoreGive(lock);
+
+    return id;
+}
+
+int ffx_setTimeout(uint32_t delay) {
+    return addTimer(delay, 0);
+}
+
+int ffx_setInterval(uint32_t period) {
+    if (period == 0) { return 0; }
+    return addTimer(period, period);
+}
+
+bool ffx_clearTimer(int id) {
+    if (id == 0) { return false; }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    // Only the Panel which set a timer may clear it
+    Timer *timer = findTimer(id);
+    if (timer && timer->panelId != panel_currentId()) { timer = NULL; }
+    if (timer) { removeTimer(timer); }
+
+    xSemaphoreGive(lock);
+
+    return (timer != NULL);
+}
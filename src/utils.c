@@ -5,6 +5,11 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
+#include "esp_timer.h"
+
+// The longest a task may run between yield points before it sleeps
+#define YIELD_BUDGET      (20 * 1000)
+
 uint32_t _ffx_lt = 0;
 
 uint32_t ticks() {
@@ -21,6 +26,27 @@ const char* taskName() {
     return xTaskDetails.pcTaskName;
 }
 
+void yieldInit(YieldState *state) {
+    state->sliceStart = esp_timer_get_time();
+    state->longest = 0;
+}
+
+void yieldPoint(YieldState *state) {
+    int64_t now = esp_timer_get_time();
+    int64_t span = now - state->sliceStart;
+    if (span > state->longest) { state->longest = span; }
+
+    if (span < YIELD_BUDGET) {
+        // Returns immediately unless another task of equal priority is
+        // ready; those do not count as a sleep for the budget
+        taskYIELD();
+        return;
+    }
+
+    vTaskDelay(1);
+    state->sliceStart = esp_timer_get_time();
+}
+
 static uint8_t readNibble(char c) {
     if (c >= 'a' && c <= 'f') { return 10 + c - 'a'; }
     if (c >= 'A' && c <= 'F') { return 10 + c - 'A'; }
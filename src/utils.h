@@ -26,6 +26,28 @@ void delay(uint32_t duration);
 const char* taskName();
 
 
+/////////////////////////////
+// Cooperative yielding
+
+// Tracks a long-running computation on the current task
+typedef struct YieldState {
+    int64_t sliceStart;
+
+    // The longest span (in us) the task ran without sleeping
+    int64_t longest;
+} YieldState;
+
+// Begin tracking a long-running computation
+void yieldInit(YieldState *state);
+
+// Call between steps of a long-running computation. This gives the CPU
+// to any other ready task of the same priority (higher priorities
+// preempt anyway) without sleeping, so an idle system is not slowed
+// down. Once the task has run for the yield budget without sleeping, it
+// sleeps a tick so lower priority tasks (and the idle watchdog) can run.
+void yieldPoint(YieldState *state);
+
+
 /////////////////////////////
 // Console functions
 